@@ -0,0 +1,120 @@
+// Count of the heap allocations of a process, for checking that the event
+// loops of the examples do not allocate per event.
+//
+// The count needs replacements of the global operator new and delete, which
+// have to be defined exactly once in a program, before any library allocates.
+// They are therefore only compiled in with NANOAODRUN1_COUNT_ALLOCATIONS,
+// which the CMake build sets for its single-source executables with
+//   cmake -S . -B build -DNANOAODRUN1_COUNT_ALLOCATIONS=ON
+// Macros run by ROOT (interpreted or compiled with ACLiC) cannot replace the
+// allocator of the running root process, so there Enabled() is false and
+// Count() is 0.
+//
+// Usage:
+//   const ULong64_t before = AllocationCounter::Count();
+//   ... event loop ...
+//   if (AllocationCounter::Enabled()) printf("%llu allocations\n", AllocationCounter::Count() - before);
+// Throughput (see Throughput.h) records the allocations of every stage.
+
+#ifndef NANOAODRUN1_ALLOCATIONCOUNTER_H
+#define NANOAODRUN1_ALLOCATIONCOUNTER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "RtypesCore.h"
+
+namespace AllocationCounter {
+
+namespace Detail {
+// Per-thread counts, one cache line each, so that concurrent event loops do
+// not contend on a shared counter
+constexpr unsigned int kMaxThreads = 256;
+struct alignas(64) Counter {
+  std::atomic<ULong64_t> count{0};
+};
+inline Counter gCounters[kMaxThreads];
+
+inline unsigned int ThreadIndex() {
+  static std::atomic<unsigned int> next{0};
+  thread_local unsigned int index = next++ % kMaxThreads;
+  return index;
+}
+
+inline void Add() {
+  auto &counter = gCounters[ThreadIndex()].count;
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+} // namespace Detail
+
+#ifdef NANOAODRUN1_COUNT_ALLOCATIONS
+constexpr bool Enabled() { return true; }
+#else
+constexpr bool Enabled() { return false; }
+#endif
+
+// Allocations with operator new (of any form) since the start of the process
+inline ULong64_t Count() {
+  ULong64_t sum = 0;
+  for (const auto &counter : Detail::gCounters) sum += counter.count.load(std::memory_order_relaxed);
+  return sum;
+}
+
+} // namespace AllocationCounter
+
+#ifdef NANOAODRUN1_COUNT_ALLOCATIONS
+// Replacements of the global allocation functions: malloc and free, like the
+// default ones of libstdc++, plus the count. GCC warns about free() of
+// memory from operator new where it inlines these into the callers.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void *operator new(std::size_t size) {
+  AllocationCounter::Detail::Add();
+  if (void *p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  AllocationCounter::Detail::Add();
+  return std::malloc(size ? size : 1);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept { return ::operator new(size, tag); }
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  AllocationCounter::Detail::Add();
+  const std::size_t align = static_cast<std::size_t>(alignment);
+  // aligned_alloc needs a nonzero multiple of the alignment
+  const std::size_t rounded = size ? (size + align - 1) / align * align : align;
+  if (void *p = std::aligned_alloc(align, rounded)) return p;
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) { return ::operator new(size, alignment); }
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  try {
+    return ::operator new(size, alignment);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept {
+  return ::operator new(size, alignment, tag);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#endif
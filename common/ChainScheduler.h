@@ -0,0 +1,310 @@
+// Dynamic load balancing of an event loop over the files of a chain.
+//
+// The files of a wildcard chain (e.g. Run2010B_Mu/*.root) can differ a lot in
+// size, so that a split into one contiguous range of entries per thread, or
+// one file per thread, leaves most threads idle while the largest ranges are
+// still being processed. ChainScheduler splits the chain into tasks, i.e.
+// ranges of entries of one file, and runs them in worker threads:
+//   - the files are distributed over the workers, largest first, each to the
+//     worker with the fewest entries so far,
+//   - every worker processes the entries of its own files in tasks of
+//     TaskEntries() entries, in file order,
+//   - a worker without entries left steals the second half of the last range
+//     of the worker with the most entries left.
+// Every worker fills its own partial results (e.g. histograms), which are
+// merged in worker order after Run(). Which entries a worker processes depends
+// on the timing, so sums of weights can differ in the last digits from run to
+// run, unless they are summed exactly (see ExactSum.h).
+//
+// TaskLog records the start and end of every task, to find slow files or
+// storage: Print() shows the slowest files and tasks and when each worker
+// finished, Write() stores all tasks in a CSV file. BookTaskLog() records the
+// tasks of an RDataFrame event loop (the entry ranges the implicit
+// multithreading processes), as far as the start of the next task of a slot.
+//
+// Usage:
+//   chain.GetEntries();                  // loads the number of entries of all files
+//   ChainScheduler scheduler(chain, nThreads);
+//   TaskLog log(nThreads);
+//   scheduler.Run([&](unsigned int worker, const ChainTask &task) {
+//     Process(task.file, task.first, task.last, partial[worker]);
+//   }, &log);
+//   log.Print();
+//   log.Write("MyMacro_tasks.csv");
+
+#ifndef NANOAODRUN1_CHAINSCHEDULER_H
+#define NANOAODRUN1_CHAINSCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ROOT/RDataFrame.hxx"
+#include "TChain.h"
+#include "TChainElement.h"
+
+// Entries [first, last) of one file of a chain
+struct ChainTask {
+  std::string file;
+  Long64_t first = 0, last = 0;
+  Long64_t Entries() const { return last - first; }
+};
+
+class TaskLog {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit TaskLog(unsigned int nSlots) : fStart(Clock::now()), fRecords(nSlots) {}
+
+  // Start a task of slot (and stop its previous one). Every slot is only
+  // recorded by one thread at a time, so no locking is needed.
+  void Start(unsigned int slot, const std::string &file, Long64_t first, Long64_t last) {
+    Stop(slot);
+    fRecords[slot].push_back({file, first, last, Now(), -1.});
+  }
+  void Stop(unsigned int slot) {
+    if (!fRecords[slot].empty() && fRecords[slot].back().stop < 0) fRecords[slot].back().stop = Now();
+  }
+  // Stop the running tasks of all slots, after the event loop
+  void Finish() {
+    for (unsigned int slot = 0; slot < fRecords.size(); slot++) Stop(slot);
+  }
+
+  // Summary per file (slowest first), the slowest tasks, and the busy time and
+  // end of every slot
+  void Print(size_t nSlowest = 5) const {
+    struct FileSum {
+      Long64_t entries = 0;
+      double seconds = 0;
+      int tasks = 0;
+    };
+    std::map<std::string, FileSum> files;
+    std::vector<std::pair<double, const Record *>> tasks;
+    for (const auto &slot : fRecords)
+      for (const auto &record : slot) {
+        FileSum &sum = files[record.file];
+        sum.entries += record.last - record.first;
+        sum.seconds += record.Seconds();
+        sum.tasks++;
+        tasks.emplace_back(record.Seconds(), &record);
+      }
+    std::vector<std::pair<std::string, FileSum>> sorted(files.begin(), files.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto &a, const auto &b) { return a.second.seconds > b.second.seconds; });
+    std::sort(tasks.begin(), tasks.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    std::printf("tasks: %zu in %zu files\n", tasks.size(), files.size());
+    for (size_t i = 0; i < sorted.size() && i < nSlowest; i++) {
+      const FileSum &sum = sorted[i].second;
+      std::printf("  file %-60s %10lld entries %3d tasks %8.2f s %10.0f entries/s\n", Short(sorted[i].first).c_str(),
+                  sum.entries, sum.tasks, sum.seconds, sum.seconds > 0 ? sum.entries / sum.seconds : 0.);
+    }
+    for (size_t i = 0; i < tasks.size() && i < nSlowest; i++) {
+      const Record &record = *tasks[i].second;
+      std::printf("  task %-46s [%lld, %lld) %8.2f s %10.0f entries/s\n", Short(record.file).c_str(), record.first,
+                  record.last, record.Seconds(),
+                  record.Seconds() > 0 ? (record.last - record.first) / record.Seconds() : 0.);
+    }
+    for (unsigned int slot = 0; slot < fRecords.size(); slot++) {
+      double busy = 0, end = 0;
+      for (const auto &record : fRecords[slot]) {
+        busy += record.Seconds();
+        end = std::max(end, record.stop);
+      }
+      std::printf("  slot %3u: %3zu tasks, busy %8.2f s, done after %8.2f s\n", slot, fRecords[slot].size(), busy,
+                  end);
+    }
+  }
+
+  // Write all tasks to a CSV file
+  void Write(const std::string &file) const {
+    std::FILE *out = std::fopen(file.c_str(), "w");
+    if (!out) {
+      std::printf("TaskLog: cannot write %s\n", file.c_str());
+      return;
+    }
+    std::fprintf(out, "slot,file,first,last,start_seconds,seconds\n");
+    for (unsigned int slot = 0; slot < fRecords.size(); slot++)
+      for (const auto &record : fRecords[slot])
+        std::fprintf(out, "%u,%s,%lld,%lld,%.6f,%.6f\n", slot, record.file.c_str(), record.first, record.last,
+                     record.start, record.Seconds());
+    std::fclose(out);
+    std::printf("task times written to %s\n", file.c_str());
+  }
+
+private:
+  struct Record {
+    std::string file;
+    Long64_t first, last;
+    double start, stop;  // seconds since the construction of the log
+    double Seconds() const { return stop >= start ? stop - start : 0.; }
+  };
+
+  double Now() const { return std::chrono::duration<double>(Clock::now() - fStart).count(); }
+  // last two path components, which identify the file of a dataset
+  static std::string Short(const std::string &file) {
+    const size_t slash = file.rfind('/');
+    const size_t dir = slash == std::string::npos || slash == 0 ? std::string::npos : file.rfind('/', slash - 1);
+    return dir == std::string::npos ? file : file.substr(dir + 1);
+  }
+
+  Clock::time_point fStart;
+  std::vector<std::vector<Record>> fRecords;  // per slot
+};
+
+// Record the tasks of an RDataFrame event loop in log, which needs one slot
+// per RDataFrame slot. The returned node has to be used for the rest of the
+// computation graph, and log.Finish() called after the event loop.
+template <typename Node>
+ROOT::RDF::RNode BookTaskLog(Node node, TaskLog &log, const std::string &column = "taskLog_") {
+  return node.DefinePerSample(column, [&log](unsigned int slot, const ROOT::RDF::RSampleInfo &id) {
+    log.Start(slot, id.AsString(), id.EntryRange().first, id.EntryRange().second);
+    return 0;
+  });
+}
+
+class ChainScheduler {
+public:
+  static constexpr Long64_t kMinTaskEntries = 100000;
+  static constexpr int kTasksPerWorker = 8;
+
+  // The files of chain and their entries, which must have been loaded before
+  // (e.g. with chain.GetEntries()). Without taskEntries, every worker gets
+  // about kTasksPerWorker tasks, of at least kMinTaskEntries entries.
+  ChainScheduler(TChain &chain, unsigned int nWorkers, Long64_t taskEntries = 0)
+    : fWorkers(std::max(1u, nWorkers)) {
+    std::vector<ChainTask> files;
+    const Long64_t *offsets = chain.GetTreeOffset();
+    for (int i = 0; i < chain.GetNtrees(); i++) {
+      auto *element = static_cast<TChainElement *>(chain.GetListOfFiles()->At(i));
+      const Long64_t entries = offsets[i + 1] - offsets[i];
+      if (entries > 0) files.push_back({element->GetTitle(), 0, entries});
+    }
+    const Long64_t total =
+      std::accumulate(files.begin(), files.end(), Long64_t(0), [](Long64_t n, const ChainTask &t) { return n + t.last; });
+    fTaskEntries = taskEntries > 0 ? taskEntries
+                                   : std::max<Long64_t>(kMinTaskEntries, total / (kTasksPerWorker * Long64_t(fWorkers.size())));
+
+    // largest file first to the least loaded worker; each worker keeps the
+    // chain order of its files
+    std::vector<size_t> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return files[a].Entries() > files[b].Entries(); });
+    std::vector<std::vector<size_t>> assigned(fWorkers.size());
+    for (size_t i : order) {
+      auto least = std::min_element(fWorkers.begin(), fWorkers.end(),
+                                    [](const Worker &a, const Worker &b) { return a.entries < b.entries; });
+      least->entries += files[i].Entries();
+      assigned[least - fWorkers.begin()].push_back(i);
+    }
+    for (size_t w = 0; w < fWorkers.size(); w++) {
+      std::sort(assigned[w].begin(), assigned[w].end());
+      for (size_t i : assigned[w]) fWorkers[w].ranges.push_back(files[i]);
+    }
+  }
+
+  Long64_t TaskEntries() const { return fTaskEntries; }
+  // Number of ranges taken from other workers
+  int Steals() const { return fSteals; }
+
+  // The next task of worker, false if all entries have been processed
+  bool Next(unsigned int worker, ChainTask &task) {
+    if (Take(fWorkers[worker], task)) return true;
+    while (Steal(worker)) {
+      if (Take(fWorkers[worker], task)) return true;
+    }
+    return false;
+  }
+
+  // Call body(worker, task) for all tasks, in one thread per worker
+  template <typename Body>
+  void Run(Body body, TaskLog *log = nullptr) {
+    std::vector<std::thread> threads;
+    for (unsigned int w = 0; w < fWorkers.size(); w++) {
+      threads.emplace_back([this, w, &body, log] {
+        ChainTask task;
+        while (Next(w, task)) {
+          if (log) log->Start(w, task.file, task.first, task.last);
+          body(w, task);
+          if (log) log->Stop(w);
+        }
+      });
+    }
+    for (auto &thread : threads) thread.join();
+  }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<ChainTask> ranges;  // entries left, in processing order
+    Long64_t entries = 0;          // sum of the entries of ranges
+  };
+
+  // Next task from the front of the own ranges
+  bool Take(Worker &worker, ChainTask &task) {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.ranges.empty()) return false;
+    ChainTask &front = worker.ranges.front();
+    task = front;
+    // the rest of a range shorter than half a task is included
+    if (front.Entries() >= fTaskEntries * 3 / 2) task.last = task.first + fTaskEntries;
+    front.first = task.last;
+    if (front.Entries() == 0) worker.ranges.pop_front();
+    worker.entries -= task.Entries();
+    return true;
+  }
+
+  // Move the second half of the last range of the busiest other worker (or
+  // the whole range if it is no longer than a task) to the ranges of thief
+  bool Steal(unsigned int thief) {
+    while (true) {
+      size_t victim = fWorkers.size();
+      Long64_t most = 0;
+      for (size_t w = 0; w < fWorkers.size(); w++) {
+        if (w == thief) continue;
+        std::lock_guard<std::mutex> lock(fWorkers[w].mutex);
+        if (fWorkers[w].entries > most) {
+          most = fWorkers[w].entries;
+          victim = w;
+        }
+      }
+      if (victim == fWorkers.size()) return false;
+
+      ChainTask stolen;
+      {
+        std::lock_guard<std::mutex> lock(fWorkers[victim].mutex);
+        auto &ranges = fWorkers[victim].ranges;
+        if (ranges.empty()) continue;  // taken in the meantime, look again
+        ChainTask &back = ranges.back();
+        stolen = back;
+        if (back.Entries() > fTaskEntries) {
+          stolen.first = back.first + back.Entries() / 2;
+          back.last = stolen.first;
+        } else {
+          ranges.pop_back();
+        }
+        fWorkers[victim].entries -= stolen.Entries();
+      }
+      std::lock_guard<std::mutex> lock(fWorkers[thief].mutex);
+      fWorkers[thief].ranges.push_back(stolen);
+      fWorkers[thief].entries += stolen.Entries();
+      fSteals++;
+      return true;
+    }
+  }
+
+  std::deque<Worker> fWorkers;  // deque: Worker is not movable
+  Long64_t fTaskEntries = kMinTaskEntries;
+  std::atomic<int> fSteals{0};
+};
+
+#endif
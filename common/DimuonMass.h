@@ -0,0 +1,86 @@
+// Batch invariant-mass kernel for muon pairs.
+//
+// The muons of an event are given as structure-of-arrays pt/eta/phi/mass
+// columns and the pairs as two index arrays. The trigonometric and
+// hyperbolic functions are evaluated once per muon, when the muons are
+// converted to Cartesian components. The pair loop then only gathers the
+// components and uses multiplications, additions and one square root. It has
+// no branches and no function calls, so the compiler can vectorize it
+// (with gcc the square root needs -fno-math-errno to be vectorized).
+//
+// The Cartesian form is equivalent to
+//   m^2 = m1^2 + m2^2 + 2 (E1 E2 - pt1 pt2 (cos(dphi) + sinh(eta1) sinh(eta2))),
+// which reduces to 2 pt1 pt2 (cosh(deta) - cos(dphi)) for massless muons.
+// It uses the same operations as TLorentzVector::SetPtEtaPhiM, operator+ and
+// M(), so the masses agree with the per-pair TLorentzVector code, as long as
+// the compiler does not contract them into fused multiply-adds
+// (-ffp-contract=off in CMakeLists.txt).
+//
+// Usage:
+//   DimuonMassKernel kernel;                         // reuse it across events
+//   kernel.SetMuons(nMuon, pt, eta, phi, mass);
+//   kernel.Masses(nPairs, first, second, masses);    // masses[k] of (first[k], second[k])
+
+#ifndef NANOAODRUN1_DIMUONMASS_H
+#define NANOAODRUN1_DIMUONMASS_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+class DimuonMassKernel {
+public:
+  // Convert n muons from (pt, eta, phi, mass) to (px, py, pz, E)
+  template <typename T>
+  void SetMuons(std::size_t n, const T *pt, const T *eta, const T *phi, const T *mass) {
+    if (fPx.size() < n) {
+      fPx.resize(n);
+      fPy.resize(n);
+      fPz.resize(n);
+      fE.resize(n);
+    }
+    double *__restrict px = fPx.data();
+    double *__restrict py = fPy.data();
+    double *__restrict pz = fPz.data();
+    double *__restrict e = fE.data();
+    for (std::size_t i = 0; i < n; i++) {
+      const double apt = std::abs(double(pt[i]));
+      const double m = mass[i];
+      px[i] = apt * std::cos(double(phi[i]));
+      py[i] = apt * std::sin(double(phi[i]));
+      pz[i] = apt * std::sinh(double(eta[i]));
+      const double p2 = px[i] * px[i] + py[i] * py[i] + pz[i] * pz[i];
+      e[i] = m >= 0 ? std::sqrt(p2 + m * m) : std::sqrt(std::fmax(p2 - m * m, 0.));
+    }
+  }
+
+  // Momentum of muon i
+  double P(std::size_t i) const {
+    return std::sqrt(fPx[i] * fPx[i] + fPy[i] * fPy[i] + fPz[i] * fPz[i]);
+  }
+
+  // Invariant masses of the pairs (first[k], second[k]) of the muons given to SetMuons
+  template <typename Index, typename Out>
+  void Masses(std::size_t nPairs, const Index *first, const Index *second, Out *mass) const {
+    const double *__restrict px = fPx.data();
+    const double *__restrict py = fPy.data();
+    const double *__restrict pz = fPz.data();
+    const double *__restrict e = fE.data();
+    for (std::size_t k = 0; k < nPairs; k++) {
+      const Index i = first[k];
+      const Index j = second[k];
+      const double x = px[i] + px[j];
+      const double y = py[i] + py[j];
+      const double z = pz[i] + pz[j];
+      const double t = e[i] + e[j];
+      const double m2 = t * t - (x * x + y * y + z * z);
+      // negative m2 (rounding) gives a negative mass, as in TLorentzVector::M()
+      mass[k] = std::copysign(std::sqrt(std::abs(m2)), m2);
+    }
+  }
+
+private:
+  std::vector<double> fPx, fPy, fPz, fE;
+};
+
+#endif
@@ -0,0 +1,262 @@
+// Table-driven selection of NanoAODRun1 dimuon candidates (Dimu_* collection)
+// for several histograms in a single pass.
+//
+// Each selection is one entry of a table: the trigger bits the event needs
+// (or must not have), the cuts common to all of its candidates, and a list
+// of trigger paths, each with its own pt threshold and mass window, of which
+// a candidate has to match at least one. The Dimu collection is looped over
+// once per event, and every candidate that survives a selection is filled
+// into that selection's histogram as log10(mass) with the weight
+// 2/ln(10)/mass, exactly like
+//   .Define("data", "log10(Dimu_mass_cut)").Define("weight", "2./log(10.)/Dimu_mass_cut")
+// followed by Histo1D. The bin is found from the mass with a table of the
+// bin edges in mass (see LogMassHistogram.h); the logarithm is only computed
+// for the means and RMS of the histograms.
+//
+// The trigger bits are taken from a ULong64_t column with one bit per HLT
+// path (or other event flag), so that a trigger requirement is a single AND.
+// Nothing is allocated per event: the columns are read in place and the
+// selected candidates go straight into the per-slot histograms, instead of
+// into a Dimu_mass_cut vector and two derived vectors per selection (this can
+// be checked with AllocationCounter.h).
+//
+// Usage:
+//   std::vector<DimuSelection> table = {...};
+//   auto result = BookDimuSelections(df, "DimuTriggers", table, nBins, x1, x2);
+//   TH1D h = result->histograms[0];   // runs the event loop
+//   result->Print();                  // cut flow of each selection
+// The result of every slot so far is available during the event loop with
+// result.OnPartialResultSlot(), e.g. for snapshots (see Progress.h).
+//
+// With exact = true, the weights are summed with ExactSum.h. The histograms
+// then do not depend on which thread processed which entries, and are bitwise
+// identical between runs and for any number of threads.
+
+#ifndef NANOAODRUN1_DIMUONSELECTION_H
+#define NANOAODRUN1_DIMUONSELECTION_H
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ROOT/RDataFrame.hxx"
+#include "ROOT/RVec.hxx"
+#include "TH1D.h"
+#include "TROOT.h"
+#include "TTreeReader.h"
+#include "ExactSum.h"
+#include "LogMassHistogram.h"
+
+// One way for a candidate to be accepted: any of the trigger bits has fired
+// (no requirement if 0), both muons are above ptMin and the mass is inside
+// (massLow, massHigh). All comparisons are strict, as in the original cuts.
+struct DimuPath {
+  ULong64_t triggers = 0;
+  double ptMin = -std::numeric_limits<double>::infinity();
+  double massLow = -std::numeric_limits<double>::infinity();
+  double massHigh = std::numeric_limits<double>::infinity();
+
+  bool Matches(ULong64_t fired, double mass, double pt1, double pt2) const {
+    return (!triggers || (fired & triggers)) && pt1 > ptMin && pt2 > ptMin && mass > massLow && mass < massHigh;
+  }
+};
+
+// One histogram of the table
+struct DimuSelection {
+  std::string name;             // histogram name
+  std::string title;            // description for the cut flow printout
+  ULong64_t eventRequire = 0;   // the event needs any of these bits (none if 0)
+  ULong64_t eventVeto = 0;      // the event is rejected if any of these bits is set
+  DimuPath cuts;                // applied to all candidates (its trigger bits are ignored)
+  std::vector<DimuPath> paths;  // a candidate has to match one of them (if any are given)
+  std::vector<DimuPath> vetoPaths;  // a candidate matching one of them is rejected
+
+  bool AcceptsEvent(ULong64_t fired) const {
+    return (!eventRequire || (fired & eventRequire)) && !(fired & eventVeto);
+  }
+
+  bool AcceptsCandidate(ULong64_t fired, double mass, double pt1, double pt2) const {
+    if (!(pt1 > cuts.ptMin && pt2 > cuts.ptMin && mass > cuts.massLow && mass < cuts.massHigh)) return false;
+    bool matched = paths.empty();
+    for (const auto &path : paths) matched = matched || path.Matches(fired, mass, pt1, pt2);
+    if (!matched) return false;
+    for (const auto &veto : vetoPaths)
+      if (veto.Matches(fired, mass, pt1, pt2)) return false;
+    return true;
+  }
+};
+
+// Histograms and event counts of all selections, in table order
+struct DimuSelectionResult {
+  std::vector<DimuSelection> selections;
+  std::vector<TH1D> histograms;
+  std::vector<ULong64_t> nEvents;           // events seen by the selection
+  std::vector<ULong64_t> nEventsTriggered;  // events passing the event requirements
+  std::vector<ULong64_t> nEventsSelected;   // events with at least one accepted candidate
+
+  // Print the cut flow of every selection, in the format of RCutFlowReport::Print
+  void Print() const {
+    for (size_t s = 0; s < selections.size(); s++) {
+      std::printf("%s (%s)\n", selections[s].name.c_str(), selections[s].title.c_str());
+      PrintLine("HLT", nEventsTriggered[s], nEvents[s], nEvents[s]);
+      PrintLine("Dimuon candidate", nEventsSelected[s], nEventsTriggered[s], nEvents[s]);
+    }
+  }
+
+private:
+  static void PrintLine(const char *name, ULong64_t pass, ULong64_t all, ULong64_t total) {
+    std::printf("%-10s: pass=%-10llu all=%-10llu -- eff=%3.2f %% cumulative eff=%3.2f %%\n", name, pass, all,
+                all ? 100. * pass / all : 0., total ? 100. * pass / total : 0.);
+  }
+};
+
+// RDataFrame action filling the histograms of all selections in one pass,
+// with the sums of weights of type Sum (double or ExactSum)
+template <typename Sum = double>
+class DimuSelectionHelper : public ROOT::Detail::RDF::RActionImpl<DimuSelectionHelper<Sum>> {
+public:
+  using Result_t = DimuSelectionResult;
+
+  DimuSelectionHelper(std::vector<DimuSelection> selections, int nBins, double xLow, double xHigh, unsigned int nSlots)
+    : fResult(std::make_shared<Result_t>()), fSlots(nSlots), fNBins(nBins), fXLow(xLow), fXHigh(xHigh)
+  {
+    const size_t n = selections.size();
+    if (n > 64) throw std::runtime_error("DimuSelectionHelper: at most 64 selections are supported");
+    fResult->selections = std::move(selections);
+    const auto axis = std::make_shared<const LogMassAxis<float>>(nBins, xLow, xHigh);
+    for (auto &slot : fSlots) {
+      slot.histograms.reserve(n);
+      slot.nEvents.assign(n, 0);
+      slot.nEventsTriggered.assign(n, 0);
+      slot.nEventsSelected.assign(n, 0);
+      for (size_t s = 0; s < n; s++) slot.histograms.emplace_back(axis, 2. / std::log(10.));
+    }
+  }
+  DimuSelectionHelper(DimuSelectionHelper &&) = default;
+  DimuSelectionHelper(const DimuSelectionHelper &) = delete;
+
+  std::shared_ptr<Result_t> GetResultPtr() const { return fResult; }
+  void Initialize() {}
+  void InitTask(TTreeReader *, unsigned int) {}
+
+  void Exec(unsigned int slot, ULong64_t fired, const ROOT::RVec<int> &Dimu_charge, const ROOT::RVec<float> &Dimu_mass,
+            const ROOT::RVec<int> &Dimu_t1muIdx, const ROOT::RVec<int> &Dimu_t2muIdx,
+            const ROOT::RVec<float> &Muon_pt, const ROOT::RVec<bool> &Muon_mediumId)
+  {
+    auto &counts = fSlots[slot];
+    const auto &selections = fResult->selections;
+    const size_t nSelections = selections.size();
+
+    // event level requirements, evaluated once per event and selection
+    ULong64_t active = 0;
+    for (size_t s = 0; s < nSelections; s++) {
+      counts.nEvents[s]++;
+      if (selections[s].AcceptsEvent(fired)) {
+        active |= 1ULL << s;
+        counts.nEventsTriggered[s]++;
+      }
+    }
+    if (!active) return;
+
+    // candidate loop, shared by all selections
+    ULong64_t selected = 0;
+    for (size_t i = 0; i < Dimu_mass.size(); i++) {
+      const int idx1 = Dimu_t1muIdx[i], idx2 = Dimu_t2muIdx[i];
+      if (Dimu_charge[i] != 0 || !Muon_mediumId[idx1] || !Muon_mediumId[idx2]) continue;
+      const float mass = Dimu_mass[i];
+      const double pt1 = Muon_pt[idx1], pt2 = Muon_pt[idx2];
+      for (size_t s = 0; s < nSelections; s++) {
+        if (!(active & (1ULL << s)) || !selections[s].AcceptsCandidate(fired, mass, pt1, pt2)) continue;
+        // bin of log10(mass) in float precision, weight 2/ln(10)/mass
+        counts.histograms[s].Fill(mass);
+        selected |= 1ULL << s;
+      }
+    }
+    for (size_t s = 0; s < nSelections; s++)
+      if (selected & (1ULL << s)) counts.nEventsSelected[s]++;
+  }
+
+  // Merge the per-slot histograms and counts, in slot order (any order with ExactSum)
+  void Finalize() {
+    auto &result = *fResult;
+    const size_t n = result.selections.size();
+    auto &sum = fSlots[0];
+    result.nEvents = sum.nEvents;
+    result.nEventsTriggered = sum.nEventsTriggered;
+    result.nEventsSelected = sum.nEventsSelected;
+    for (size_t slot = 1; slot < fSlots.size(); slot++) {
+      for (size_t s = 0; s < n; s++) {
+        sum.histograms[s].Add(fSlots[slot].histograms[s]);
+        result.nEvents[s] += fSlots[slot].nEvents[s];
+        result.nEventsTriggered[s] += fSlots[slot].nEventsTriggered[s];
+        result.nEventsSelected[s] += fSlots[slot].nEventsSelected[s];
+      }
+    }
+    BookHistograms(result);
+    for (size_t s = 0; s < n; s++) sum.histograms[s].CopyTo(result.histograms[s]);
+  }
+
+  // Histograms and counts of slot so far, in its own result
+  Result_t &PartialUpdate(unsigned int slot) {
+    auto &data = fSlots[slot];
+    auto &partial = data.partial;
+    if (partial.histograms.empty()) {
+      partial.selections = fResult->selections;
+      BookHistograms(partial);
+    }
+    partial.nEvents = data.nEvents;
+    partial.nEventsTriggered = data.nEventsTriggered;
+    partial.nEventsSelected = data.nEventsSelected;
+    for (size_t s = 0; s < data.histograms.size(); s++) data.histograms[s].CopyTo(partial.histograms[s]);
+    return partial;
+  }
+
+  std::string GetActionName() { return "DimuSelection"; }
+
+private:
+  // Empty histograms of the selections of result, not attached to a directory
+  void BookHistograms(Result_t &result) const {
+    result.histograms.clear();
+    result.histograms.reserve(result.selections.size());
+    for (const auto &selection : result.selections) {
+      result.histograms.emplace_back(selection.name.c_str(), selection.name.c_str(), fNBins, fXLow, fXHigh);
+      result.histograms.back().SetDirectory(nullptr);
+    }
+  }
+
+  struct SlotData {
+    std::vector<LogMassHistogram<float, Sum>> histograms;
+    std::vector<ULong64_t> nEvents, nEventsTriggered, nEventsSelected;
+    Result_t partial;  // for PartialUpdate
+  };
+
+  std::shared_ptr<Result_t> fResult;
+  std::vector<SlotData> fSlots;
+  int fNBins;
+  double fXLow, fXHigh;
+};
+
+// Book the single-pass filling of all selections of the table on an
+// RDataFrame node. triggerColumn is the ULong64_t column with the trigger bits;
+// with exact, the histograms are summed with ExactSum.
+template <typename Node>
+ROOT::RDF::RResultPtr<DimuSelectionResult> BookDimuSelections(Node node, const std::string &triggerColumn,
+                                                              std::vector<DimuSelection> selections,
+                                                              int nBins, double xLow, double xHigh,
+                                                              bool exact = false)
+{
+  const unsigned int nSlots = ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1;
+  const std::vector<std::string> columns = {triggerColumn, "Dimu_charge", "Dimu_mass", "Dimu_t1muIdx",
+                                            "Dimu_t2muIdx", "Muon_pt", "Muon_mediumId"};
+  auto book = [&](auto helper) {
+    return node.template Book<ULong64_t, ROOT::RVec<int>, ROOT::RVec<float>, ROOT::RVec<int>, ROOT::RVec<int>,
+                              ROOT::RVec<float>, ROOT::RVec<bool>>(std::move(helper), columns);
+  };
+  if (exact) return book(DimuSelectionHelper<ExactSum>(std::move(selections), nBins, xLow, xHigh, nSlots));
+  return book(DimuSelectionHelper<>(std::move(selections), nBins, xLow, xHigh, nSlots));
+}
+
+#endif
@@ -0,0 +1,97 @@
+// Sum of doubles that does not depend on the order of the additions, for
+// histograms that are bitwise reproducible at any number of threads.
+//
+// The weighted histograms of a multithreaded event loop are filled per thread
+// and added at the end. Which entries a thread processes changes from run to
+// run and with the number of threads, and floating-point addition is not
+// associative, so the last bits of the bin contents and errors change too.
+// An ExactSum keeps the sum in 128-bit fixed point with 80 fraction bits:
+// every value is converted once (exactly for magnitudes from 2^-27 to 2^46,
+// truncated to a multiple of 2^-80 below that), after which additions are
+// exact integer additions, in any order and grouping. The sum is rounded to
+// double only when it is read. It is the correctly rounded sum of the
+// converted values, so it can differ in the last bits from the sum of a
+// sequential loop in double precision, which rounds after every addition.
+//
+// The values must be below 2^46 and the sums below 2^47 (about 1.4e14) in
+// magnitude. A fill of LogMassHistogram takes about 1.5 times as long as
+// with double sums, mostly for the conversion.
+//
+// BasicExactSum<F> is the same sum with F fraction bits, for larger values:
+// below 2^(126 - F), with sums below 2^(127 - F), exact from 2^(53 - F) up
+// and for multiples of 2^-F (e.g. integers), truncated to multiples of 2^-F
+// otherwise. HistogramBank.h chooses F from the ranges of its axes for the
+// statistics (sums of w*x and w*x^2).
+//
+// Used for the histograms of MuHistos_eospublic.cxx, and with
+// NANOAODRUN1_DETERMINISTIC=1 for the weighted histograms of
+// Dimuon2011_eospublic_RDF2.C (see DimuonSelection.h).
+//
+// Usage:
+//   ExactSum sum;
+//   sum += w;            // in any order, also sum += otherThread
+//   double s = double(sum);
+//   BasicExactSum<40> wide;   // values up to 2^86
+
+#ifndef NANOAODRUN1_EXACTSUM_H
+#define NANOAODRUN1_EXACTSUM_H
+
+#include <cmath>
+#include <cstdlib>
+
+namespace Deterministic {
+
+// NANOAODRUN1_DETERMINISTIC=1
+inline bool Enabled() {
+  const char *deterministic = std::getenv("NANOAODRUN1_DETERMINISTIC");
+  return deterministic && std::atoi(deterministic) != 0;
+}
+
+} // namespace Deterministic
+
+template <int FractionBits>
+class BasicExactSum {
+  static_assert(FractionBits >= 0 && FractionBits <= 126, "a 128-bit sum has at most 126 fraction bits");
+
+public:
+  static constexpr int kFractionBits = FractionBits;
+
+  BasicExactSum() = default;
+  BasicExactSum(double value) : fSum(ToFixed(value)) {}
+
+  BasicExactSum &operator+=(double value) {
+    fSum += ToFixed(value);
+    return *this;
+  }
+  BasicExactSum &operator+=(const BasicExactSum &other) {
+    fSum += other.fSum;
+    return *this;
+  }
+
+  explicit operator double() const { return std::ldexp(static_cast<double>(fSum), -kFractionBits); }
+
+private:
+  static constexpr double Pow2(int exponent) {
+    double p = 1;
+    for (; exponent > 0; exponent--) p *= 2;
+    for (; exponent < 0; exponent++) p /= 2;
+    return p;
+  }
+
+  // value * 2^F truncated to an integer, from two 64-bit conversions (the
+  // 128-bit conversion is a library call): the multiples of 2^(63 - F), and
+  // the remainder, which is exact, in units of 2^-F
+  static __int128 ToFixed(double value) {
+    constexpr double kScale = Pow2(kFractionBits - 63);
+    const double scaled = value * kScale;
+    const auto high = static_cast<long long>(scaled);
+    const auto low = static_cast<long long>((scaled - high) * 0x1p63);
+    return static_cast<__int128>(high) * (static_cast<__int128>(1) << 63) + low;
+  }
+
+  __int128 fSum = 0;
+};
+
+using ExactSum = BasicExactSum<80>;
+
+#endif
@@ -0,0 +1,167 @@
+// Fused fill of several fixed-binning histograms.
+//
+// A HistogramBank holds the bin contents, sums of squared weights and
+// statistics of N one-dimensional histograms with fixed bin widths in two
+// contiguous arrays. Fill takes one value per histogram and updates all of
+// them in one pass, without the virtual calls, axis lookups and buffer and
+// extension checks of N calls of TH1::Fill. The binning is a constexpr table
+// given as template argument, so the bin offsets and edges are constants of
+// the fill loop, which the compiler unrolls.
+//
+// The bins are found with the same expression as TAxis::FindFixBin, and the
+// contents and statistics are updated in the same order as TH1::Fill, so
+// histograms copied to TH1D with CopyTo are identical to histograms filled
+// with TH1::Fill in the same order (also after Add, as with TH1::Add).
+// Banks filled in parallel threads, with entries split between them at run
+// time, therefore differ in the last bits of the statistics (mean and RMS),
+// and of the bin contents with non-integer weights, from run to run.
+//
+// An ExactHistogramBank sums the statistics with BasicExactSum (ExactSum.h)
+// instead, with as many fraction bits as the largest |x| of its axes allows
+// for up to 2^40 entries of weight up to 1. The statistics then do not depend
+// on the order of the entries and of the Add() calls, and differ from those of
+// TH1::Fill only by the single rounding at the end. The bin contents are
+// still double sums, which are exact for integer weights, so with integer
+// weights the histograms are bitwise the same however the entries were split.
+//
+// Usage:
+//   constexpr std::array<FixedAxis, 2> kAxes = {{{240, 0., 120.}, {140, -3.5, 3.5}}};
+//   HistogramBank<kAxes> bank;                      // one per thread
+//   ExactHistogramBank<kAxes> exact;                // or with exact statistics
+//   bank.Fill({p, eta});                            // one entry in each histogram
+//   bank.Fill({p, eta}, {w, w});                    // with weights
+//   bank.Add(otherBank);
+//   bank.CopyTo(1, *h_eta);                         // h_eta booked with kAxes[1], e.g. at write time
+
+#ifndef NANOAODRUN1_HISTOGRAMBANK_H
+#define NANOAODRUN1_HISTOGRAMBANK_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include "TArrayD.h"
+#include "TH1D.h"
+#include "ExactSum.h"
+
+// Number of bins and range of a fixed-binning axis, as given to the TH1D constructor
+struct FixedAxis {
+  int nBins;
+  double low, high;
+
+  // Bin of x as TAxis::FindFixBin: 0 underflow, nBins + 1 overflow (also NaN)
+  constexpr int Bin(double x) const {
+    if (x < low) return 0;
+    if (!(x < high)) return nBins + 1;
+    return 1 + int(nBins * (x - low) / (high - low));
+  }
+};
+
+template <const auto &Axes, typename Sum = double>
+class HistogramBank {
+public:
+  static constexpr std::size_t N = Axes.size();
+  using Values = std::array<double, N>;
+
+  HistogramBank() { Reset(); }
+
+  void Reset() {
+    fSumw.fill(0);
+    fSumw2.fill(0);
+    fStats.fill(Stats());
+  }
+
+  // One entry with weight 1 in every histogram i at x[i]
+  void Fill(const Values &x) { Fill(x, Ones()); }
+
+  // One entry with weight w[i] in every histogram i at x[i]
+  void Fill(const Values &x, const Values &w) {
+    for (std::size_t i = 0; i < N; i++) {
+      const int bin = Axes[i].Bin(x[i]);
+      const std::size_t cell = kOffsets[i] + bin;
+      fSumw[cell] += w[i];
+      fSumw2[cell] += w[i] * w[i];
+      Stats &s = fStats[i];
+      s.entries++;
+      // like TH1::Fill, underflow and overflow do not enter the statistics
+      if (bin == 0 || bin > Axes[i].nBins) continue;
+      s.sumw += w[i];
+      s.sumw2 += w[i] * w[i];
+      s.sumwx += w[i] * x[i];
+      s.sumwx2 += w[i] * x[i] * x[i];
+    }
+  }
+
+  void Add(const HistogramBank &other) {
+    for (std::size_t cell = 0; cell < kCells; cell++) {
+      fSumw[cell] += other.fSumw[cell];
+      fSumw2[cell] += other.fSumw2[cell];
+    }
+    for (std::size_t i = 0; i < N; i++) {
+      fStats[i].entries += other.fStats[i].entries;
+      fStats[i].sumw += other.fStats[i].sumw;
+      fStats[i].sumw2 += other.fStats[i].sumw2;
+      fStats[i].sumwx += other.fStats[i].sumwx;
+      fStats[i].sumwx2 += other.fStats[i].sumwx2;
+    }
+  }
+
+  double Entries(std::size_t i) const { return fStats[i].entries; }
+
+  // Replace the contents, errors, statistics and entries of h, which must be
+  // booked with the binning Axes[i], by those of histogram i
+  void CopyTo(std::size_t i, TH1D &h) const {
+    const FixedAxis &axis = Axes[i];
+    if (h.GetNbinsX() != axis.nBins || h.GetXaxis()->GetXmin() != axis.low || h.GetXaxis()->GetXmax() != axis.high ||
+        h.GetXaxis()->IsVariableBinSize())
+      throw std::runtime_error(std::string("HistogramBank: binning of ") + h.GetName() + " differs");
+    if (h.GetSumw2N() == 0) h.Sumw2();
+    std::copy(&fSumw[kOffsets[i]], &fSumw[kOffsets[i]] + axis.nBins + 2, h.GetArray());
+    std::copy(&fSumw2[kOffsets[i]], &fSumw2[kOffsets[i]] + axis.nBins + 2, h.GetSumw2()->GetArray());
+    const Stats &s = fStats[i];
+    double stats[4] = {double(s.sumw), double(s.sumw2), double(s.sumwx), double(s.sumwx2)};
+    h.PutStats(stats);
+    h.SetEntries(s.entries);
+  }
+
+private:
+  struct Stats {
+    double entries = 0;
+    Sum sumw = 0, sumw2 = 0, sumwx = 0, sumwx2 = 0;
+  };
+
+  // first cell (underflow bin) of every histogram in the arrays
+  static constexpr std::array<std::size_t, N + 1> Offsets() {
+    std::array<std::size_t, N + 1> offsets{};
+    for (std::size_t i = 0; i < N; i++) offsets[i + 1] = offsets[i] + Axes[i].nBins + 2;
+    return offsets;
+  }
+  static constexpr Values Ones() {
+    Values ones{};
+    for (auto &one : ones) one = 1;
+    return ones;
+  }
+  static constexpr std::array<std::size_t, N + 1> kOffsets = Offsets();
+  static constexpr std::size_t kCells = kOffsets[N];
+
+  std::array<double, kCells> fSumw, fSumw2;
+  std::array<Stats, N> fStats;
+};
+
+// Fraction bits of exact statistics of the axes: the sums of w*x^2 of up to
+// 2^40 entries with |w| <= 1 have to stay below 2^(127 - F)
+template <std::size_t N>
+constexpr int ExactStatsFractionBits(const std::array<FixedAxis, N> &axes) {
+  double maxX2 = 1;
+  for (const auto &axis : axes)
+    for (double x : {axis.low, axis.high}) maxX2 = std::max(maxX2, x * x);
+  int bits = 0;
+  for (double p = 1; p < maxX2; p *= 2) bits++;
+  return std::min(80, 86 - bits);
+}
+
+template <const auto &Axes>
+using ExactHistogramBank = HistogramBank<Axes, BasicExactSum<ExactStatsFractionBits(Axes)>>;
+
+#endif
@@ -0,0 +1,191 @@
+// Histogram of log10(mass) with the Jacobian weight c/mass, filled from the
+// mass itself.
+//
+// The log-mass spectra of the examples fill x = log10(m) with weight c/m
+// (c = 2/ln10 or 200/ln10), so that the plot reads as events per unit mass.
+// A LogMassHistogram takes m and finds its bin from a table of the bin edges
+// in mass: an approximate log2 from the exponent and mantissa bits gives a
+// first guess, which is corrected by comparisons with the table. The edges
+// are computed once, by bisection over all values of the mass type, as the
+// smallest masses for which TAxis::FindFixBin(log10(m)) reaches each bin, so
+// every mass goes into the same bin as with the logarithm (log10 is
+// monotonic).
+//
+// The weight still has to be computed per entry: it varies within a bin, so
+// a per-bin factor applied at the end would change the contents and errors.
+// So does x = log10(m) of the entries inside the axis range, in the precision
+// of T like log10 of the mass columns, for the sums of w*x and w*x^2 of the
+// mean and RMS. The contents, errors, entries and statistics are identical to
+// those of TH1::Fill(std::log10(m), c / m) in the same order.
+//
+// With Sum = ExactSum (ExactSum.h) instead of double, the sums of the
+// contents and statistics do not depend on the order of the entries and of
+// the Add() calls, so that the result of a multithreaded fill is bitwise
+// reproducible.
+//
+// Usage:
+//   const auto axis = std::make_shared<const LogMassAxis<float>>(620, -0.4, 2.7);   // shared by all threads
+//   LogMassHistogram<float> h(axis, 2. / std::log(10.));
+//   h.Fill(mass);                      // like hist->Fill(std::log10(mass), 2. / std::log(10.) / mass)
+//   h.Fill(mass, w);                   // like hist->Fill(std::log10(mass), w)
+//   h.Add(otherThread);
+//   h.CopyTo(*hist);                   // hist booked with the same binning
+//   LogMassHistogram<float, ExactSum> exact(axis, 2. / std::log(10.));
+
+#ifndef NANOAODRUN1_LOGMASSHISTOGRAM_H
+#define NANOAODRUN1_LOGMASSHISTOGRAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "TArrayD.h"
+#include "TH1D.h"
+#include "HistogramBank.h"
+
+// Fixed binning in log10(m), looked up with the mass. T is the type of the
+// masses (float or double); the bins are those of std::log10(T), i.e. float
+// masses are binned like log10 of float precision.
+template <typename T>
+class LogMassAxis {
+  static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value, "float or double masses");
+  using Bits = typename std::conditional<std::is_same<T, float>::value, std::uint32_t, std::uint64_t>::type;
+
+public:
+  LogMassAxis(int nBins, double low, double high) : fAxis{nBins, low, high}, fEdges(nBins + 1) {
+    if (nBins <= 0 || !(low < high)) throw std::invalid_argument("LogMassAxis: invalid binning");
+    for (int k = 0; k <= nBins; k++) fEdges[k] = Smallest(k + 1);
+    fScale = nBins * std::log10(2.) / (high - low);
+    fOffset = 1 - nBins * low / (high - low);
+  }
+
+  const FixedAxis &Axis() const { return fAxis; }
+
+  // Bin of log10(m) as TAxis::FindFixBin: 0 underflow (also m = 0), nBins + 1
+  // overflow (also negative masses and NaN, whose logarithm is NaN)
+  int Bin(T m) const {
+    if (!(m > 0)) return m == 0 ? 0 : fAxis.nBins + 1;
+    int bin = Guess(m);
+    while (bin <= fAxis.nBins && !(m < fEdges[bin])) bin++;
+    while (bin > 0 && m < fEdges[bin - 1]) bin--;
+    return bin;
+  }
+
+private:
+  // bin from an approximate log2: exponent plus a quadratic in the mantissa
+  // (error below 0.01), then scaled to the axis; Bin() corrects it
+  int Guess(T m) const {
+    const double value = m;
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const int exponent = int(bits >> 52) - 1023;
+    const double f = double(bits & ((std::uint64_t(1) << 52) - 1)) * 0x1p-52;
+    const double log2m = exponent + f + 0.3466 * f * (1 - f);
+    const double guess = log2m * fScale + fOffset;
+    if (!(guess > 0)) return 0;
+    if (!(guess < fAxis.nBins + 1)) return fAxis.nBins + 1;
+    return int(guess);
+  }
+
+  // smallest positive T whose bin is at least bin
+  T Smallest(int bin) const {
+    Bits lowBits = 0, highBits = ToBits(std::numeric_limits<T>::infinity());
+    while (highBits - lowBits > 1) {
+      const Bits middle = lowBits + (highBits - lowBits) / 2;
+      if (fAxis.Bin(std::log10(FromBits(middle))) >= bin)
+        highBits = middle;
+      else
+        lowBits = middle;
+    }
+    return FromBits(highBits);
+  }
+
+  static Bits ToBits(T value) {
+    Bits bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+  static T FromBits(Bits bits) {
+    T value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  FixedAxis fAxis;
+  std::vector<T> fEdges;  // fEdges[k]: smallest mass of bin k + 1 or above
+  double fScale, fOffset;
+};
+
+template <typename T, typename Sum = double>
+class LogMassHistogram {
+public:
+  // jacobian: c of the weight c/m
+  LogMassHistogram(std::shared_ptr<const LogMassAxis<T>> axis, double jacobian)
+    : fAxis(std::move(axis)), fJacobian(jacobian), fSumw(fAxis->Axis().nBins + 2), fSumw2(fAxis->Axis().nBins + 2) {}
+
+  // One entry at log10(m) with weight jacobian / m
+  void Fill(T m) { Fill(m, fJacobian / m); }
+
+  // One entry at log10(m) with weight w, e.g. a Jacobian weight computed with
+  // a different precision
+  void Fill(T m, double w) {
+    const int bin = fAxis->Bin(m);
+    fSumw[bin] += w;
+    fSumw2[bin] += w * w;
+    fEntries++;
+    // like TH1::Fill, underflow and overflow do not enter the statistics
+    if (bin == 0 || bin > fAxis->Axis().nBins) return;
+    const double x = std::log10(m);
+    fTsumw += w;
+    fTsumw2 += w * w;
+    fTsumwx += w * x;
+    fTsumwx2 += w * x * x;
+  }
+
+  void Add(const LogMassHistogram &other) {
+    for (size_t bin = 0; bin < fSumw.size(); bin++) {
+      fSumw[bin] += other.fSumw[bin];
+      fSumw2[bin] += other.fSumw2[bin];
+    }
+    fEntries += other.fEntries;
+    fTsumw += other.fTsumw;
+    fTsumw2 += other.fTsumw2;
+    fTsumwx += other.fTsumwx;
+    fTsumwx2 += other.fTsumwx2;
+  }
+
+  double Entries() const { return fEntries; }
+
+  // Replace the contents, errors, statistics and entries of h, which must be
+  // booked with the binning of the axis
+  void CopyTo(TH1D &h) const {
+    const FixedAxis &axis = fAxis->Axis();
+    if (h.GetNbinsX() != axis.nBins || h.GetXaxis()->GetXmin() != axis.low || h.GetXaxis()->GetXmax() != axis.high ||
+        h.GetXaxis()->IsVariableBinSize())
+      throw std::runtime_error(std::string("LogMassHistogram: binning of ") + h.GetName() + " differs");
+    if (h.GetSumw2N() == 0) h.Sumw2();
+    double *sumw = h.GetArray(), *sumw2 = h.GetSumw2()->GetArray();
+    for (size_t bin = 0; bin < fSumw.size(); bin++) {
+      sumw[bin] = double(fSumw[bin]);
+      sumw2[bin] = double(fSumw2[bin]);
+    }
+    double stats[4] = {double(fTsumw), double(fTsumw2), double(fTsumwx), double(fTsumwx2)};
+    h.PutStats(stats);
+    h.SetEntries(fEntries);
+  }
+
+private:
+  std::shared_ptr<const LogMassAxis<T>> fAxis;
+  double fJacobian;
+  std::vector<Sum> fSumw, fSumw2;
+  double fEntries = 0;
+  Sum fTsumw = 0, fTsumw2 = 0, fTsumwx = 0, fTsumwx2 = 0;
+};
+
+#endif
@@ -0,0 +1,411 @@
+// Columnar file of dimuon candidates for refilling mass histograms.
+//
+// An event loop can write the final (mass, weight, selection bits) of every
+// dimuon candidate it fills into a histogram into a flat binary file. Any
+// binning of the mass or log10(mass) spectrum can then be filled from this
+// file, in parallel and at memory speed, without running the event loop
+// again (see tools/refillMassHistogram.C).
+//
+// File layout (all blocks 64 byte aligned, native byte order):
+//   file header:  magic "NAODMCS1", version, length of the selection names,
+//                 number of candidates, number of row groups, selection names
+//   row groups:   number of candidates n, then the columns
+//                 float mass[n], float weight[n], ULong64_t selection[n]
+//
+// Writing, from several threads with one slot each:
+//   MassCandidateWriter out("masses.bin", nSlots, {"opposite sign"});
+//   out.Add(slot, mass, weight, 1);   // bit i set: candidate passes selection i
+//   out.Close();
+// or in an RDataFrame event loop:
+//   auto n = BookMassCandidates(df, "Dimuon_mass", out);
+//
+// Reading:
+//   MassCandidateStore in("masses.bin");
+//   in.FillMass(h);                               // h->Fill(mass, weight)
+//   in.FillLog10Mass(h, 1, 200 / log(10));        // h->Fill(log10(mass), weight * 200 / log(10) / mass)
+
+#ifndef NANOAODRUN1_MASSCANDIDATESTORE_H
+#define NANOAODRUN1_MASSCANDIDATESTORE_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ROOT/RDataFrame.hxx"
+#include "TAxis.h"
+#include "TH1.h"
+
+namespace MassCandidateFormat {
+
+constexpr char kMagic[8] = {'N', 'A', 'O', 'D', 'M', 'C', 'S', '1'};
+constexpr std::uint32_t kVersion = 1;
+constexpr std::size_t kAlignment = 64;
+
+struct FileHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t namesLength;  // bytes of the '\n' separated selection names that follow
+  std::uint64_t nCandidates;
+  std::uint64_t nGroups;
+  char reserved[32];
+};
+static_assert(sizeof(FileHeader) == kAlignment, "the file header is one aligned block");
+
+struct GroupHeader {
+  std::uint64_t nCandidates;
+  char reserved[56];
+};
+static_assert(sizeof(GroupHeader) == kAlignment, "the row group header is one aligned block");
+
+inline std::size_t Padded(std::size_t bytes) { return (bytes + kAlignment - 1) / kAlignment * kAlignment; }
+
+// Bytes of a row group with n candidates, including its header
+inline std::size_t GroupSize(std::uint64_t n) {
+  return sizeof(GroupHeader) + Padded(n * sizeof(float)) * 2 + Padded(n * sizeof(ULong64_t));
+}
+
+} // namespace MassCandidateFormat
+
+// Writes candidates in row groups. Each slot (thread) has its own buffer,
+// which is appended to the file as one row group when it is full.
+class MassCandidateWriter {
+public:
+  static constexpr std::size_t kRowGroupSize = 1 << 16;
+
+  MassCandidateWriter(const std::string &file, unsigned int nSlots, const std::vector<std::string> &selections = {})
+    : fName(file), fSlots(nSlots)
+  {
+    for (const auto &selection : selections) fNames += selection + "\n";
+    fFile = std::fopen(file.c_str(), "wb");
+    if (!fFile) throw std::runtime_error("MassCandidateWriter: cannot create " + file);
+    for (auto &slot : fSlots) slot.Reserve();
+    try {
+      WriteHeader();
+    } catch (...) {
+      std::fclose(fFile);
+      throw;
+    }
+  }
+  MassCandidateWriter(const MassCandidateWriter &) = delete;
+  MassCandidateWriter &operator=(const MassCandidateWriter &) = delete;
+  // Closes the file if Close() was not called; a write error can only be
+  // reported, not thrown, here
+  ~MassCandidateWriter() {
+    try {
+      Close();
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "%s\n", e.what());
+    }
+  }
+
+  void Add(unsigned int slot, float mass, float weight, ULong64_t selection) {
+    auto &buffer = fSlots[slot];
+    buffer.mass.push_back(mass);
+    buffer.weight.push_back(weight);
+    buffer.selection.push_back(selection);
+    if (buffer.mass.size() == kRowGroupSize) Flush(buffer);
+  }
+
+  // Write the remaining candidates of all slots and the final file header.
+  // The file is closed also if this fails.
+  void Close() {
+    if (!fFile) return;
+    try {
+      for (auto &buffer : fSlots) Flush(buffer);
+      WriteHeader();
+    } catch (...) {
+      std::fclose(fFile);
+      fFile = nullptr;
+      throw;
+    }
+    const bool closed = std::fclose(fFile) == 0;
+    fFile = nullptr;
+    if (!closed) throw std::runtime_error("MassCandidateWriter: cannot write to " + fName);
+  }
+
+  ULong64_t Size() const { return fCandidates; }
+  const std::string &GetName() const { return fName; }
+
+private:
+  struct Buffer {
+    std::vector<float> mass, weight;
+    std::vector<ULong64_t> selection;
+    void Reserve() {
+      mass.reserve(kRowGroupSize);
+      weight.reserve(kRowGroupSize);
+      selection.reserve(kRowGroupSize);
+    }
+    void Clear() {
+      mass.clear();
+      weight.clear();
+      selection.clear();
+    }
+  };
+
+  void WriteHeader() {
+    using namespace MassCandidateFormat;
+    FileHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.namesLength = fNames.size();
+    header.nCandidates = fCandidates;
+    header.nGroups = fGroups;
+    Seek(0, SEEK_SET);
+    Write(&header, sizeof(header));
+    Write(fNames.data(), fNames.size());
+    Pad(sizeof(header) + fNames.size());
+    Seek(0, SEEK_END);
+  }
+
+  void Flush(Buffer &buffer) {
+    using namespace MassCandidateFormat;
+    const std::uint64_t n = buffer.mass.size();
+    if (n == 0) return;
+    GroupHeader header{};
+    header.nCandidates = n;
+    {
+      std::lock_guard<std::mutex> lock(fMutex);
+      Write(&header, sizeof(header));
+      Write(buffer.mass.data(), n * sizeof(float));
+      Pad(n * sizeof(float));
+      Write(buffer.weight.data(), n * sizeof(float));
+      Pad(n * sizeof(float));
+      Write(buffer.selection.data(), n * sizeof(ULong64_t));
+      Pad(n * sizeof(ULong64_t));
+      fCandidates += n;
+      fGroups++;
+    }
+    buffer.Clear();
+  }
+
+  void Write(const void *data, std::size_t bytes) {
+    if (bytes && std::fwrite(data, 1, bytes, fFile) != bytes)
+      throw std::runtime_error("MassCandidateWriter: cannot write to " + fName);
+  }
+
+  // fseek also writes the buffered data
+  void Seek(long offset, int whence) {
+    if (std::fseek(fFile, offset, whence) != 0)
+      throw std::runtime_error("MassCandidateWriter: cannot write to " + fName);
+  }
+
+  void Pad(std::size_t bytes) {
+    static const char zeros[MassCandidateFormat::kAlignment] = {};
+    Write(zeros, MassCandidateFormat::Padded(bytes) - bytes);
+  }
+
+  std::string fName;
+  std::string fNames;
+  std::vector<Buffer> fSlots;
+  std::FILE *fFile = nullptr;
+  std::mutex fMutex;
+  std::uint64_t fCandidates = 0;
+  std::uint64_t fGroups = 0;
+};
+
+// Read-only, memory-mapped view of a candidate file
+class MassCandidateStore {
+public:
+  explicit MassCandidateStore(const std::string &file) : fName(file) {
+    using namespace MassCandidateFormat;
+    const int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("MassCandidateStore: cannot open " + file);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("MassCandidateStore: cannot stat " + file);
+    }
+    fSize = st.st_size;
+    if (fSize >= sizeof(FileHeader)) fData = ::mmap(nullptr, fSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (fSize < sizeof(FileHeader) || fData == MAP_FAILED)
+      throw std::runtime_error("MassCandidateStore: cannot map " + file);
+
+    const char *base = static_cast<const char *>(fData);
+    const auto *header = reinterpret_cast<const FileHeader *>(base);
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion)
+      Fail(file + " is not a candidate file");
+    if (Padded(sizeof(FileHeader) + header->namesLength) > fSize) Fail(file + " is truncated");
+    fCandidates = header->nCandidates;
+
+    std::string names(base + sizeof(FileHeader), header->namesLength);
+    for (std::size_t begin = 0, end; (end = names.find('\n', begin)) != std::string::npos; begin = end + 1)
+      fSelections.push_back(names.substr(begin, end - begin));
+
+    // locate the row groups
+    std::size_t offset = Padded(sizeof(FileHeader) + header->namesLength);
+    for (std::uint64_t g = 0; g < header->nGroups; g++) {
+      if (offset + sizeof(GroupHeader) > fSize) Fail(file + " is truncated");
+      const auto *group = reinterpret_cast<const GroupHeader *>(base + offset);
+      const std::uint64_t n = group->nCandidates;
+      // n is compared with the bytes left before GroupSize(n), which can overflow
+      if (n > (fSize - offset) / (2 * sizeof(float) + sizeof(ULong64_t)) || offset + GroupSize(n) > fSize)
+        Fail(file + " is truncated");
+      Group columns;
+      columns.n = n;
+      columns.mass = reinterpret_cast<const float *>(base + offset + sizeof(GroupHeader));
+      columns.weight = reinterpret_cast<const float *>(reinterpret_cast<const char *>(columns.mass) + Padded(n * sizeof(float)));
+      columns.selection = reinterpret_cast<const ULong64_t *>(reinterpret_cast<const char *>(columns.weight) + Padded(n * sizeof(float)));
+      fGroups.push_back(columns);
+      offset += GroupSize(n);
+    }
+    ::madvise(fData, fSize, MADV_SEQUENTIAL);
+  }
+  MassCandidateStore(const MassCandidateStore &) = delete;
+  MassCandidateStore &operator=(const MassCandidateStore &) = delete;
+  ~MassCandidateStore() { ::munmap(fData, fSize); }
+
+  ULong64_t Size() const { return fCandidates; }
+  const std::vector<std::string> &Selections() const { return fSelections; }
+
+  // Fill h with (mass, weight) of the candidates with any of the selection bits
+  void FillMass(TH1 &h, ULong64_t selection = ~0ULL, unsigned int nThreads = 0) const {
+    Fill(h, selection, [](float mass, float weight, double &x, double &w) { x = mass; w = weight; }, nThreads);
+  }
+
+  // Fill h with log10(mass) and the weight multiplied by scale / mass, e.g.
+  // scale = 200 / ln(10) for the 200 bins per decade of GM_mass_log. The
+  // logarithm is taken in float precision, like log10 of the float masses in
+  // the event loops, so that candidates at bin edges end up in the same bins.
+  void FillLog10Mass(TH1 &h, ULong64_t selection = ~0ULL, double scale = 1, unsigned int nThreads = 0) const {
+    Fill(h, selection,
+         [scale](float mass, float weight, double &x, double &w) {
+           x = std::log10(mass);
+           w = weight * (scale / mass);
+         },
+         nThreads);
+  }
+
+  // Fill h with the x and weight computed by transform(mass, weight, x, w).
+  // The row groups are split into nThreads (default: all cores) contiguous
+  // ranges, each filling its own bin arrays, which are added in range order.
+  // Bin contents, errors, entries and statistics are the same as from h.Fill(x, w).
+  template <typename Transform>
+  void Fill(TH1 &h, ULong64_t selection, Transform transform, unsigned int nThreads = 0) const {
+    if (h.GetDimension() != 1) throw std::runtime_error("MassCandidateStore: only 1D histograms can be filled");
+    if (nThreads == 0) nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::max<std::size_t>(1, std::min<std::size_t>(nThreads, fGroups.size()));
+    const TAxis &axis = *h.GetXaxis();
+    const int nCells = axis.GetNbins() + 2;
+
+    std::vector<Sums> sums(nThreads, Sums(nCells));
+    auto work = [&](unsigned int t) {
+      Sums &s = sums[t];
+      const std::size_t begin = fGroups.size() * t / nThreads, end = fGroups.size() * (t + 1) / nThreads;
+      for (std::size_t g = begin; g < end; g++) {
+        const Group &group = fGroups[g];
+        for (std::uint64_t i = 0; i < group.n; i++) {
+          if (!(group.selection[i] & selection)) continue;
+          double x, w;
+          transform(group.mass[i], group.weight[i], x, w);
+          const int bin = axis.FindFixBin(x);
+          s.sumw[bin] += w;
+          s.sumw2[bin] += w * w;
+          s.entries++;
+          if (bin > 0 && bin < nCells - 1) {
+            s.stats[0] += w;
+            s.stats[1] += w * w;
+            s.stats[2] += w * x;
+            s.stats[3] += w * x * x;
+          }
+        }
+      }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < nThreads; t++) workers.emplace_back(work, t);
+    if (!fGroups.empty()) work(0);
+    for (auto &worker : workers) worker.join();
+
+    // add to the histogram, in range order
+    if (!h.GetSumw2N()) h.Sumw2();
+    double stats[4] = {0, 0, 0, 0};
+    h.GetStats(stats);
+    double entries = h.GetEntries();
+    for (const auto &s : sums) {
+      for (int bin = 0; bin < nCells; bin++) {
+        h.AddBinContent(bin, s.sumw[bin]);
+        h.GetSumw2()->fArray[bin] += s.sumw2[bin];
+      }
+      for (int k = 0; k < 4; k++) stats[k] += s.stats[k];
+      entries += s.entries;
+    }
+    h.PutStats(stats);
+    h.SetEntries(entries);
+  }
+
+private:
+  // Unmap the file and throw, for a file that cannot be read
+  [[noreturn]] void Fail(const std::string &message) {
+    ::munmap(fData, fSize);
+    throw std::runtime_error("MassCandidateStore: " + message);
+  }
+
+  struct Group {
+    std::uint64_t n = 0;
+    const float *mass = nullptr;
+    const float *weight = nullptr;
+    const ULong64_t *selection = nullptr;
+  };
+
+  struct Sums {
+    explicit Sums(int nCells) : sumw(nCells), sumw2(nCells) {}
+    std::vector<double> sumw, sumw2;
+    double stats[4] = {0, 0, 0, 0};  // sum of w, w^2, w x, w x^2 in the axis range
+    double entries = 0;
+  };
+
+  std::string fName;
+  void *fData = nullptr;
+  std::size_t fSize = 0;
+  ULong64_t fCandidates = 0;
+  std::vector<std::string> fSelections;
+  std::vector<Group> fGroups;
+};
+
+// RDataFrame action writing every entry of a float mass column to the writer
+// with unit weight and the given selection bits. The writer needs at least as
+// many slots as the data frame. The result is the number of candidates written;
+// the writer is closed at the end of the event loop.
+class MassCandidateHelper : public ROOT::Detail::RDF::RActionImpl<MassCandidateHelper> {
+public:
+  using Result_t = ULong64_t;
+
+  MassCandidateHelper(MassCandidateWriter &writer, ULong64_t selection)
+    : fWriter(&writer), fSelection(selection), fResult(std::make_shared<ULong64_t>(0)) {}
+  MassCandidateHelper(MassCandidateHelper &&) = default;
+  MassCandidateHelper(const MassCandidateHelper &) = delete;
+
+  std::shared_ptr<Result_t> GetResultPtr() const { return fResult; }
+  void Initialize() {}
+  void InitTask(TTreeReader *, unsigned int) {}
+  void Exec(unsigned int slot, float mass) { fWriter->Add(slot, mass, 1.f, fSelection); }
+  void Finalize() {
+    fWriter->Close();
+    *fResult = fWriter->Size();
+  }
+  std::string GetActionName() { return "MassCandidates"; }
+
+private:
+  MassCandidateWriter *fWriter;
+  ULong64_t fSelection;
+  std::shared_ptr<Result_t> fResult;
+};
+
+template <typename Node>
+ROOT::RDF::RResultPtr<ULong64_t> BookMassCandidates(Node node, const std::string &massColumn,
+                                                    MassCandidateWriter &writer, ULong64_t selection = 1)
+{
+  return node.template Book<float>(MassCandidateHelper(writer, selection), {massColumn});
+}
+
+#endif
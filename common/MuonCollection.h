@@ -0,0 +1,204 @@
+// Structure-of-arrays reader for the Muon collection of NanoAODRun1 files.
+//
+// All Muon_* branches are read into contiguous, 64 byte aligned arrays
+// owned by the collection. The arrays are sized from the maximum of the
+// nMuon leaf count and grow (by doubling) only when an event with more
+// muons than the current capacity is found, so the branch buffers can
+// never overflow.
+//
+// Usage:
+//   MuonCollection mu;
+//   mu.Bind(tree);            // enables and binds nMuon and all Muon_* branches
+//   mu.GetEntry(entry);       // reads the entry, like TTree::GetEntry
+//   for (unsigned int i = 0; i < mu.nMuon; i++) ... mu.pt[i] ...
+//
+// or, reading the muon columns only for events passing a preselection:
+//   mu.GetScalars(entry);     // nMuon and the other active branches, e.g. run
+//   if (mu.nMuon < 2) continue;
+//   mu.GetColumn(mu.charge);  // optionally single columns for further cuts
+//   mu.GetMuons();            // all Muon_* columns not read yet
+//
+// A basket of a branch is only decompressed when one of its entries is read,
+// so with the two-phase reading the baskets of the Muon_* columns of runs of
+// events failing the preselection are never decompressed (the compressed
+// baskets are still read with the read-ahead cache).
+
+#ifndef NANOAODRUN1_MUONCOLLECTION_H
+#define NANOAODRUN1_MUONCOLLECTION_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+#include "TTree.h"
+
+// Columns of the Muon collection: type and branch name without the "Muon_" prefix
+#define MUON_COLLECTION_COLUMNS(X) \
+  X(Float_t, mass)                 \
+  X(Float_t, pt)                   \
+  X(Float_t, gpt)                  \
+  X(Float_t, eta)                  \
+  X(Float_t, geta)                 \
+  X(Float_t, phi)                  \
+  X(Float_t, gphi)                 \
+  X(Float_t, gChi2)                \
+  X(Int_t, charge)                 \
+  X(Bool_t, isTracker)             \
+  X(Bool_t, isGlobal)              \
+  X(Int_t, nValid)                 \
+  X(Int_t, gnValid)                \
+  X(Int_t, gnValidMu)              \
+  X(Int_t, nPix)                   \
+  X(Int_t, gnPix)
+
+class MuonCollection {
+public:
+  // number of muons in the current event
+  UInt_t nMuon = 0;
+
+  // one array per column, e.g. pt[i] is Muon_pt of the i-th muon
+#define MUON_COLLECTION_MEMBER(type, name) type *name = nullptr;
+  MUON_COLLECTION_COLUMNS(MUON_COLLECTION_MEMBER)
+#undef MUON_COLLECTION_MEMBER
+
+  MuonCollection() = default;
+  MuonCollection(const MuonCollection &) = delete;
+  MuonCollection &operator=(const MuonCollection &) = delete;
+  ~MuonCollection() { std::free(fBuffer); }
+
+  // Enable nMuon and all Muon_* branches of the tree and bind them to this collection
+  void Bind(TTree *tree) {
+    fTree = tree;
+    fTreeNumber = -1;
+    tree->SetBranchStatus("nMuon", 1);
+#define MUON_COLLECTION_ENABLE(type, name) tree->SetBranchStatus("Muon_" #name, 1);
+    MUON_COLLECTION_COLUMNS(MUON_COLLECTION_ENABLE)
+#undef MUON_COLLECTION_ENABLE
+    tree->SetBranchAddress("nMuon", &nMuon);
+    Reserve(kMinCapacity);
+  }
+
+  // Read the entry of all active branches of the tree. The number of muons is
+  // read first, so that the arrays can be enlarged before they are filled.
+  Int_t GetEntry(Long64_t entry) {
+    if (LoadEntry(entry) < 0) return 0;
+    fRead = kAllColumns;
+    return fTree->GetEntry(entry);
+  }
+
+  // Phase one of the two-phase reading: read nMuon and all other active
+  // branches that are not Muon_* columns of the entry
+  Int_t GetScalars(Long64_t entry) {
+    if (LoadEntry(entry) < 0) return 0;
+    fRead = 0;
+    Int_t bytes = 0;
+    for (TBranch *branch : fScalarBranches) bytes += branch->GetEntry(fLocal);
+    return bytes;
+  }
+
+  // Read one column of the entry of the last GetScalars, e.g. GetColumn(mu.isGlobal)
+  template <typename T>
+  Int_t GetColumn(const T *column) {
+#define MUON_COLLECTION_GET(type, name) \
+    if ((const void *)column == (const void *)name) return ReadColumn(k_##name);
+    MUON_COLLECTION_COLUMNS(MUON_COLLECTION_GET)
+#undef MUON_COLLECTION_GET
+    return 0;
+  }
+
+  // Phase two: read the Muon_* columns of the entry of the last GetScalars
+  // that have not been read with GetColumn
+  Int_t GetMuons() {
+    Int_t bytes = 0;
+    for (int i = 0; i < kNColumns; i++) bytes += ReadColumn(i);
+    return bytes;
+  }
+
+  // Number of muons the arrays can currently hold
+  UInt_t Capacity() const { return fCapacity; }
+
+private:
+  static constexpr UInt_t kMinCapacity = 16;
+  static constexpr size_t kAlignment = 64;
+
+  // index of every column, e.g. k_pt
+  enum {
+#define MUON_COLLECTION_INDEX(type, name) k_##name,
+    MUON_COLLECTION_COLUMNS(MUON_COLLECTION_INDEX)
+#undef MUON_COLLECTION_INDEX
+    kNColumns
+  };
+  static constexpr UInt_t kAllColumns = (1u << kNColumns) - 1;
+
+  // Load the tree of the entry and read nMuon. Returns the local entry.
+  Long64_t LoadEntry(Long64_t entry) {
+    fLocal = fTree->LoadTree(entry);
+    if (fLocal < 0) return fLocal;
+    if (fTree->GetTreeNumber() != fTreeNumber) {
+      // new file of a chain: size the arrays from its largest event
+      fTreeNumber = fTree->GetTreeNumber();
+      TTree *tree = fTree->GetTree();
+      fCountBranch = tree->GetBranch("nMuon");
+      TLeaf *count = tree->GetLeaf("nMuon");
+      if (count) Reserve((UInt_t)count->GetMaximum());
+#define MUON_COLLECTION_BRANCH(type, name) fColumnBranches[k_##name] = tree->GetBranch("Muon_" #name);
+      MUON_COLLECTION_COLUMNS(MUON_COLLECTION_BRANCH)
+#undef MUON_COLLECTION_BRANCH
+      // the active branches that are not part of the collection
+      fScalarBranches.clear();
+      for (TObject *object : *tree->GetListOfBranches()) {
+        auto *branch = static_cast<TBranch *>(object);
+        if (branch->TestBit(TBranch::kDoNotProcess) || branch == fCountBranch ||
+            std::strncmp(branch->GetName(), "Muon_", 5) == 0)
+          continue;
+        fScalarBranches.push_back(branch);
+      }
+    }
+    fCountBranch->GetEntry(fLocal);
+    if (nMuon > fCapacity) Reserve(std::max(nMuon, 2 * fCapacity));
+    return fLocal;
+  }
+
+  Int_t ReadColumn(int i) {
+    if (fRead & (1u << i)) return 0;
+    fRead |= 1u << i;
+    return fColumnBranches[i] ? fColumnBranches[i]->GetEntry(fLocal) : 0;
+  }
+
+  // Make room for at least n muons per column and rebind the branches
+  void Reserve(UInt_t n) {
+    if (n <= fCapacity) return;
+    size_t size = 0;
+#define MUON_COLLECTION_SIZE(type, name) size += Padded(n * sizeof(type));
+    MUON_COLLECTION_COLUMNS(MUON_COLLECTION_SIZE)
+#undef MUON_COLLECTION_SIZE
+    std::free(fBuffer);
+    fBuffer = static_cast<char *>(std::aligned_alloc(kAlignment, size));
+    fCapacity = n;
+
+    char *column = fBuffer;
+#define MUON_COLLECTION_ADDRESS(type, name)                     \
+    name = reinterpret_cast<type *>(column);                    \
+    column += Padded(n * sizeof(type));                         \
+    fTree->SetBranchAddress("Muon_" #name, name);
+    MUON_COLLECTION_COLUMNS(MUON_COLLECTION_ADDRESS)
+#undef MUON_COLLECTION_ADDRESS
+  }
+
+  static size_t Padded(size_t bytes) { return (bytes + kAlignment - 1) / kAlignment * kAlignment; }
+
+  TTree *fTree = nullptr;
+  TBranch *fCountBranch = nullptr;
+  TBranch *fColumnBranches[kNColumns] = {};
+  std::vector<TBranch *> fScalarBranches;  // active branches other than nMuon and Muon_*
+  Int_t fTreeNumber = -1;
+  Long64_t fLocal = -1;                    // local entry of the last GetScalars
+  UInt_t fRead = 0;                        // columns of this entry already read
+  UInt_t fCapacity = 0;
+  char *fBuffer = nullptr;
+};
+
+#endif
@@ -0,0 +1,49 @@
+// Location of the NanoAODRun1 input files and number of threads of the examples.
+//
+// By default the examples stream their input from eospublic. Two environment
+// variables override this without editing the scripts:
+//   NANOAODRUN1_INDIR     directory with local files of the same names, e.g.
+//                         written by tools/generateNanoAODRun1.C or xrdcp
+//   NANOAODRUN1_NTHREADS  number of threads instead of the default of the script
+//
+// Usage:
+//   t1->Add(NanoAODRun1Input::Path("Run2010B_Mu_merged.root").c_str());
+//   ROOT::EnableImplicitMT(NanoAODRun1Input::Threads(12));
+
+#ifndef NANOAODRUN1_NANOAODRUN1INPUT_H
+#define NANOAODRUN1_NANOAODRUN1INPUT_H
+
+#include <cstdlib>
+#include <string>
+
+namespace NanoAODRun1Input {
+
+// Directory of the NanoAODRun1 files on eospublic
+inline const std::string kEOSPublic = "root://eospublic.cern.ch//eos/opendata/cms/derived-data/NanoAODRun1/01-Jul-22/";
+
+// Input directory with a trailing slash: NANOAODRUN1_INDIR if set, else eospublic
+inline std::string Dir() {
+  const char *dir = std::getenv("NANOAODRUN1_INDIR");
+  if (!dir || !*dir) return kEOSPublic;
+  std::string result = dir;
+  if (result.back() != '/') result += '/';
+  return result;
+}
+
+// Full name of an input file or glob relative to the NanoAODRun1 directory,
+// e.g. "Run2011A_MuOnia_merged.root" or "Run2010B_Mu/*.root"
+inline std::string Path(const std::string &name) { return Dir() + name; }
+
+// NANOAODRUN1_NTHREADS if set to a number, else the default of the script
+// (0 means all cores for ROOT::EnableImplicitMT)
+inline unsigned int Threads(unsigned int defaultThreads) {
+  const char *threads = std::getenv("NANOAODRUN1_NTHREADS");
+  if (!threads || !*threads) return defaultThreads;
+  char *end = nullptr;
+  unsigned long n = std::strtoul(threads, &end, 10);
+  return *end == '\0' ? (unsigned int)n : defaultThreads;
+}
+
+} // namespace NanoAODRun1Input
+
+#endif
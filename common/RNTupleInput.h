@@ -0,0 +1,71 @@
+// Reading the NanoAODRun1 inputs as RNTuple instead of TTree.
+//
+// tools/convertToRNTuple.C rewrites NanoAODRun1 files, or skims of them, into
+// another directory under the same file names, with an "Events" RNTuple of
+// the same columns and column types. With
+//   NANOAODRUN1_FORMAT=rntuple NANOAODRUN1_INDIR=<that directory>
+// the RDataFrame examples read these files instead of the TTree files, with
+// the same selections. The skim cache and shards work on TTree clusters and
+// are not used with RNTuple input; the result store is.
+//
+// RNTuple files are read through ROOT's raw file layer rather than TFile, so
+// their bytes do not show up in TFile::GetFileBytesRead() and the read
+// throughput of Throughput.h; tools/compareFormats.C measures them.
+//
+// Needs ROOT 6.34 or newer (RNTuple 1.0 format, RDataFrame and Snapshot
+// support for RNTuple).
+//
+// Usage:
+//   const bool rntuple = RNTupleInput::Enabled();
+//   ROOT::RDataFrame df = rntuple ? RNTupleInput::DataFrame("Events", files) : ROOT::RDataFrame(chain);
+//   ULong64_t n = RNTupleInput::Entries("Events", files);
+
+#ifndef NANOAODRUN1_RNTUPLEINPUT_H
+#define NANOAODRUN1_RNTUPLEINPUT_H
+
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ROOT/RDataFrame.hxx"
+#include "ROOT/RNTupleReader.hxx"
+#include "RVersion.h"
+#include "RtypesCore.h"
+#include "SkimCache.h"
+
+namespace RNTupleInput {
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 35, 0)
+using ROOT::RNTupleReader;
+#else
+using ROOT::Experimental::RNTupleReader;
+#endif
+
+// NANOAODRUN1_FORMAT: "ttree" (default) or "rntuple"
+inline bool Enabled() {
+  const char *format = std::getenv("NANOAODRUN1_FORMAT");
+  if (!format || !*format || std::string(format) == "ttree") return false;
+  if (std::string(format) == "rntuple") return true;
+  throw std::runtime_error(std::string("NANOAODRUN1_FORMAT: unknown format ") + format + ", use ttree or rntuple");
+}
+
+// Individual file names of the inputs, with wildcards resolved
+inline std::vector<std::string> Files(const std::vector<std::string> &inputs) {
+  return SkimCache::Expand("Events", inputs);
+}
+
+// RDataFrame over the RNTuple name in the inputs (which may contain wildcards)
+inline ROOT::RDataFrame DataFrame(const std::string &name, const std::vector<std::string> &inputs) {
+  return ROOT::RDataFrame(name, Files(inputs));
+}
+
+// Number of entries of the RNTuple name in the inputs, from their metadata
+inline ULong64_t Entries(const std::string &name, const std::vector<std::string> &inputs) {
+  ULong64_t entries = 0;
+  for (const auto &file : Files(inputs)) entries += RNTupleReader::Open(name, file)->GetNEntries();
+  return entries;
+}
+
+} // namespace RNTupleInput
+
+#endif
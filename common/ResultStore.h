@@ -0,0 +1,138 @@
+// Persistent store of the results of the RDataFrame examples per input file.
+//
+// With NANOAODRUN1_RESULTSTORE=<directory>, an example processes its input
+// files one by one and stores the histograms, event counts and cut flows of
+// every file (a ShardOutput, see Shard.h) in <directory>/<example>/. Later
+// runs read the stored results of the files they have already processed and
+// only run the event loop over new or changed files, e.g. when files are
+// added to the directories of a chain. The results of all files are added in
+// input order.
+//
+// A stored result is identified by a hash of the example, the version of its
+// selection, the file name and the UUID and size of the file. The UUID is
+// written by ROOT when a file is created, so a rewritten file has a new one;
+// this takes the place of a checksum, which would need a full read of the
+// file. Change the version in the example when its selection or binning
+// changes, or delete the directory.
+//
+// Usage:
+//   ResultStore store = ResultStore::FromEnv("MyMacro", "1");
+//   if (store.Enabled())
+//     output = store.Process("Events", files, [&](const std::string &file) { return fill({file}); });
+//
+// As for shards, event counts and unweighted histograms are the same as for
+// a single event loop over all files; sums of weights can differ in the last
+// digits.
+
+#ifndef NANOAODRUN1_RESULTSTORE_H
+#define NANOAODRUN1_RESULTSTORE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "TFile.h"
+#include "TSystem.h"
+#include "TUUID.h"
+#include "Shard.h"
+#include "SkimCache.h"
+
+class ResultStore {
+public:
+  // directory: empty to disable the store
+  ResultStore(std::string macro, std::string version, std::string directory)
+    : fMacro(std::move(macro)), fVersion(std::move(version)), fDirectory(std::move(directory)) {}
+
+  // The directory is taken from NANOAODRUN1_RESULTSTORE; disabled if unset
+  static ResultStore FromEnv(std::string macro, std::string version) {
+    const char *directory = std::getenv("NANOAODRUN1_RESULTSTORE");
+    return ResultStore(std::move(macro), std::move(version), directory ? directory : "");
+  }
+
+  bool Enabled() const { return !fDirectory.empty(); }
+
+  // Sum of the results of the inputs (which may contain wildcards), in input
+  // order. The results of inputs that are not in the store are computed with
+  // fill(file), which returns a ShardOutput, and stored.
+  template <typename F>
+  ShardOutput Process(const std::string &treeName, const std::vector<std::string> &inputs, F fill) {
+    const std::string directory = fDirectory + "/" + fMacro;
+    gSystem->mkdir(directory.c_str(), true);
+    ShardOutput sum;
+    const std::vector<std::string> files = SkimCache::Expand(treeName, inputs);
+    const size_t nProcessed = fProcessed.size();
+    for (size_t i = 0; i < files.size(); i++) {
+      const std::string key = Key(files[i]);
+      const std::string stored = directory + "/" + SkimCache::BaseName(files[i]) + "_" + SkimCache::Hash(key) + ".root";
+      ShardOutput output;
+      if (Find(stored, key, output)) {
+        fReused.push_back(files[i]);
+        for (const auto &title : output.CutFlowTitles()) {
+          const auto cuts = output.CutFlow(title);
+          if (!cuts.empty()) fReusedEvents[title] += cuts[0].all;
+        }
+      } else {
+        std::printf("result store: processing %s\n", files[i].c_str());
+        output = fill(files[i]);
+        Store(stored, key, output);
+        fProcessed.push_back(files[i]);
+      }
+      if (i == 0)
+        sum = std::move(output);
+      else
+        sum.Merge(output);
+    }
+    std::printf("result store %s: %zu of %zu files processed, the others reused\n", directory.c_str(),
+                fProcessed.size() - nProcessed, files.size());
+    return sum;
+  }
+
+  const std::vector<std::string> &Processed() const { return fProcessed; }
+  const std::vector<std::string> &Reused() const { return fReused; }
+
+  // Number of events of the reused results, from the first cut of the cut flow
+  ULong64_t ReusedEvents(const std::string &cutFlow) const {
+    const auto events = fReusedEvents.find(cutFlow);
+    return events == fReusedEvents.end() ? 0 : events->second;
+  }
+
+private:
+  static constexpr const char *kVersion = "1";
+
+  // Identity of the results of file: opens the file for its UUID and size
+  std::string Key(const std::string &file) const {
+    std::unique_ptr<TFile> f(TFile::Open(file.c_str()));
+    if (!f || f->IsZombie()) throw std::runtime_error("ResultStore: cannot open " + file);
+    return std::string("ResultStore v") + kVersion + "\nmacro: " + fMacro + "\nversion: " + fVersion +
+           "\nfile: " + file + "\nuuid: " + f->GetUUID().AsString() + "\nsize: " + std::to_string(f->GetSize());
+  }
+
+  static bool Find(const std::string &stored, const std::string &key, ShardOutput &output) {
+    if (gSystem->AccessPathName(stored.c_str())) return false;
+    std::string label;
+    try {
+      output = ShardOutput::Read(stored, &label);
+    } catch (const std::runtime_error &) {
+      return false;
+    }
+    return label == key;
+  }
+
+  // Write under a temporary name and rename when complete, so that an
+  // interrupted run never leaves a partial result in the store
+  static void Store(const std::string &stored, const std::string &key, const ShardOutput &output) {
+    const std::string tmp = stored + ".part";
+    output.Write(tmp, key);
+    if (gSystem->Rename(tmp.c_str(), stored.c_str()) != 0)
+      throw std::runtime_error("ResultStore: cannot rename " + tmp + " to " + stored);
+  }
+
+  std::string fMacro, fVersion, fDirectory;
+  std::vector<std::string> fProcessed, fReused;
+  std::map<std::string, ULong64_t> fReusedEvents;  // per cut flow
+};
+
+#endif
@@ -0,0 +1,392 @@
+// Sharded execution of the RDataFrame examples, in several processes or on
+// several machines.
+//
+// With NANOAODRUN1_SHARD=i/n, an example processes only the i-th of n parts
+// of its input (i = 0 ... n-1) and writes its histograms and event counts to
+// <example>_shard<i>of<n>.root instead of making its plots. The parts are
+// contiguous ranges of entries of the input chain which start and end at
+// cluster boundaries, chosen from the clusters of all input files, so that
+// they only depend on the input; a shard only reads the files that overlap
+// its range, through an entry list. With NANOAODRUN1_SHARD=merge/n, the example reads the n shard
+// files instead of running its event loops, adds them in shard order, and
+// makes the same plots and printouts as a single-process run.
+//
+// The shards read the original files, i.e. the skim cache is not used, so
+// their cut flows start from all events of the input. Event counts and
+// unweighted histograms of the merged output are identical to those of a
+// single-process run; sums of weights can differ in the last digits, since
+// they are added in a different order (as between two multithreaded runs).
+//
+// Usage:
+//   Shard shard = Shard::FromEnv();
+//   ShardInput input = shard.Select("Events", files);     // chain of all files if not sharded
+//   ROOT::RDataFrame df(*input.chain);
+//   ... event loop ...
+//   ShardOutput output;
+//   output.Add("mass", *hist);
+//   output.AddCutFlow("Events", *report);
+//   if (shard.Active()) output.Write(shard.FileName("MyMacro"), shard.Label());
+// and when merging:
+//   ShardOutput output = ShardOutput::Merge("MyMacro", shard.Count());
+//   TH1D &mass = output.Histogram("mass");
+//
+// tools/runShards.sh runs the shards of an example as local processes and
+// merges them; tools/mergeShards.C adds or compares shard files. ResultStore.h
+// keeps a ShardOutput per input file to reprocess only new files.
+
+#ifndef NANOAODRUN1_SHARD_H
+#define NANOAODRUN1_SHARD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ROOT/RCutFlowReport.hxx"
+#include "ROOT/RDataFrame.hxx"
+#include "TChain.h"
+#include "TEntryList.h"
+#include "TFile.h"
+#include "TH1D.h"
+#include "TList.h"
+#include "TNamed.h"
+#include "TParameter.h"
+
+// The input of one shard: a chain of the files that overlap the shard, with
+// an entry list of the entries of the shard (none if not sharded), which
+// RDataFrame also respects in multithreaded event loops
+struct ShardInput {
+  std::shared_ptr<TChain> chain;
+  std::shared_ptr<TEntryList> entries;
+
+  // Number of entries the event loop processes, e.g. for the progress report
+  Long64_t Entries() const { return entries ? entries->GetN() : chain->GetEntries(); }
+};
+
+class Shard {
+public:
+  Shard() = default;
+  Shard(unsigned int index, unsigned int count, bool merge = false) : fIndex(index), fCount(count), fMerge(merge) {
+    if (fCount == 0 || (!fMerge && fIndex >= fCount)) throw std::runtime_error("Shard: invalid shard " + Label());
+  }
+
+  // From NANOAODRUN1_SHARD: "i/n" for shard i of n, "merge/n" to merge n
+  // shards; not sharded if unset
+  static Shard FromEnv() {
+    const char *value = std::getenv("NANOAODRUN1_SHARD");
+    if (!value || !*value) return Shard();
+    const std::string spec = value;
+    const size_t slash = spec.find('/');
+    if (slash == std::string::npos) throw std::runtime_error("Shard: NANOAODRUN1_SHARD must be i/n or merge/n");
+    const std::string index = spec.substr(0, slash);
+    const int count = std::atoi(spec.c_str() + slash + 1);
+    if (count <= 0) throw std::runtime_error("Shard: invalid NANOAODRUN1_SHARD " + spec);
+    if (index == "merge") return Shard(0, count, true);
+    return Shard(std::atoi(index.c_str()), count);
+  }
+
+  // Processing one shard (also 0/1, the whole input written as a shard file)
+  bool Active() const { return fCount > 0 && !fMerge; }
+  // Merging the shard files instead of processing the input
+  bool Merging() const { return fMerge; }
+  unsigned int Index() const { return fIndex; }
+  unsigned int Count() const { return fCount; }
+  std::string Label() const {
+    return (fMerge ? std::string("merge") : std::to_string(fIndex)) + "/" + std::to_string(fCount);
+  }
+
+  static std::string FileName(const std::string &prefix, unsigned int index, unsigned int count) {
+    return prefix + "_shard" + std::to_string(index) + "of" + std::to_string(count) + ".root";
+  }
+  std::string FileName(const std::string &prefix) const { return FileName(prefix, fIndex, fCount); }
+
+  // Name for the outputs of a process (e.g. the throughput file), which
+  // differs between the shards
+  std::string Name(const std::string &macro) const {
+    if (fMerge) return macro + "_merge" + std::to_string(fCount);
+    if (Active()) return macro + "_shard" + std::to_string(fIndex) + "of" + std::to_string(fCount);
+    return macro;
+  }
+
+  // The files (which may contain wildcards) and entries of this shard
+  ShardInput Select(const std::string &treeName, const std::vector<std::string> &inputs) const {
+    ShardInput input;
+    input.chain = std::make_shared<TChain>(treeName.c_str());
+    for (const auto &file : inputs) input.chain->Add(file.c_str());
+    if (!Active()) return input;
+
+    TChain &chain = *input.chain;
+    const Long64_t total = chain.GetEntries();
+    const int nFiles = chain.GetNtrees();
+    const std::vector<Long64_t> offsets(chain.GetTreeOffset(), chain.GetTreeOffset() + nFiles + 1);
+    std::vector<std::string> files;
+    for (int i = 0; i < nFiles; i++) files.push_back(chain.GetListOfFiles()->At(i)->GetTitle());
+
+    // first entries of all clusters, in chain entries
+    std::vector<Long64_t> clusters;
+    for (int i = 0; i < nFiles; i++) {
+      if (offsets[i + 1] == offsets[i]) continue;
+      chain.LoadTree(offsets[i]);
+      TTree *tree = chain.GetTree();
+      auto iterator = tree->GetClusterIterator(0);
+      for (Long64_t start; (start = iterator()) < tree->GetEntries();) clusters.push_back(offsets[i] + start);
+    }
+    const size_t nClusters = clusters.size();
+    auto boundary = [&](unsigned int shard) {
+      const size_t cluster = nClusters * shard / fCount;
+      return cluster < nClusters ? clusters[cluster] : total;
+    };
+    const Long64_t begin = boundary(fIndex), end = boundary(fIndex + 1);
+    // an empty entry list would select all entries
+    if (begin == end)
+      throw std::runtime_error("Shard: shard " + Label() + " is empty, the input has only " +
+                               std::to_string(nClusters) + " clusters");
+
+    // chain of the files overlapping [begin, end), with one entry list per file
+    input.chain = std::make_shared<TChain>(treeName.c_str());
+    input.entries = std::make_shared<TEntryList>("shard", Label().c_str());
+    int nShardFiles = 0;
+    for (int i = 0; i < nFiles; i++) {
+      if (offsets[i] >= end || offsets[i + 1] <= begin) continue;
+      input.chain->Add(files[i].c_str(), offsets[i + 1] - offsets[i]);
+      TEntryList entries("", "", treeName.c_str(), files[i].c_str());
+      const Long64_t last = std::min(end, offsets[i + 1]) - offsets[i];
+      for (Long64_t entry = std::max(begin, offsets[i]) - offsets[i]; entry < last; entry++) entries.Enter(entry);
+      input.entries->Add(&entries);
+      nShardFiles++;
+    }
+    input.chain->SetEntryList(input.entries.get());
+    std::printf("shard %s: entries [%lld, %lld) of %lld, %d of %d files\n", Label().c_str(), begin, end, total,
+                nShardFiles, nFiles);
+    return input;
+  }
+
+private:
+  unsigned int fIndex = 0, fCount = 0;
+  bool fMerge = false;
+};
+
+// Histograms, event counts and cut flows of a (shard of an) example
+class ShardOutput {
+public:
+  struct Cut {
+    std::string name;
+    ULong64_t pass, all;
+  };
+
+  ShardOutput() = default;
+  ShardOutput(ShardOutput &&) = default;
+  ShardOutput &operator=(ShardOutput &&) = default;
+
+  // Store a copy of h under name (which must not contain '/')
+  void Add(const std::string &name, const TH1D &h) {
+    if (name.find('/') != std::string::npos) throw std::runtime_error("ShardOutput: invalid name " + name);
+    auto copy = std::make_unique<TH1D>(h);
+    copy->SetDirectory(nullptr);
+    copy->SetName(name.c_str());
+    fHistograms.emplace_back(name, std::move(copy));
+  }
+  void AddCount(const std::string &name, ULong64_t count) { fCounts.emplace_back(name, count); }
+  void AddCutFlow(const std::string &title, const ROOT::RDF::RCutFlowReport &report) {
+    std::vector<Cut> cuts;
+    for (const auto &cut : report) cuts.push_back({cut.GetName(), cut.GetPass(), cut.GetAll()});
+    AddCutFlow(title, cuts);
+  }
+  void AddCutFlow(const std::string &title, const std::vector<Cut> &cuts) {
+    fCutFlows.emplace_back(title, std::vector<std::string>());
+    for (const auto &cut : cuts) {
+      fCutFlows.back().second.push_back(cut.name);
+      AddCount(CutKey(title, cut.name, "pass"), cut.pass);
+      AddCount(CutKey(title, cut.name, "all"), cut.all);
+    }
+  }
+
+  std::vector<std::string> CutFlowTitles() const {
+    std::vector<std::string> titles;
+    for (const auto &flow : fCutFlows) titles.push_back(flow.first);
+    return titles;
+  }
+
+  TH1D &Histogram(const std::string &name) const {
+    for (const auto &h : fHistograms)
+      if (h.first == name) return *h.second;
+    throw std::runtime_error("ShardOutput: no histogram " + name);
+  }
+  ULong64_t Count(const std::string &name) const {
+    for (const auto &count : fCounts)
+      if (count.first == name) return count.second;
+    throw std::runtime_error("ShardOutput: no count " + name);
+  }
+  std::vector<Cut> CutFlow(const std::string &title) const {
+    std::vector<Cut> cuts;
+    for (const auto &flow : fCutFlows)
+      if (flow.first == title)
+        for (const auto &name : flow.second)
+          cuts.push_back({name, Count(CutKey(title, name, "pass")), Count(CutKey(title, name, "all"))});
+    return cuts;
+  }
+  // in the format of RCutFlowReport::Print
+  void PrintCutFlow(const std::string &title) const {
+    const auto cuts = CutFlow(title);
+    size_t width = 0;
+    for (const auto &cut : cuts) width = std::max(width, cut.name.size());
+    for (const auto &cut : cuts)
+      std::printf("%-*s: pass=%-10llu all=%-10llu -- eff=%3.2f %% cumulative eff=%3.2f %%\n", int(width),
+                  cut.name.c_str(), cut.pass, cut.all, cut.all ? 100. * cut.pass / cut.all : 0.,
+                  cuts[0].all ? 100. * cut.pass / cuts[0].all : 0.);
+  }
+
+  void Write(const std::string &file, const std::string &shard) const {
+    TFile out(file.c_str(), "RECREATE");
+    if (out.IsZombie()) throw std::runtime_error("ShardOutput: cannot write " + file);
+    std::string names;
+    for (const auto &h : fHistograms) {
+      h.second->Write(h.first.c_str());
+      names += h.first + "\n";
+    }
+    TNamed("histograms", names.c_str()).Write();
+    TList counts, cutFlows;
+    counts.SetOwner();
+    cutFlows.SetOwner();
+    for (const auto &count : fCounts) counts.Add(new TParameter<Long64_t>(count.first.c_str(), count.second));
+    for (const auto &flow : fCutFlows) {
+      std::string cuts;
+      for (const auto &name : flow.second) cuts += name + "\n";
+      cutFlows.Add(new TNamed(flow.first.c_str(), cuts.c_str()));
+    }
+    counts.Write("counts", TObject::kSingleKey);
+    cutFlows.Write("cutflows", TObject::kSingleKey);
+    TNamed("shard", shard.c_str()).Write();
+    std::printf("output written to %s\n", file.c_str());
+  }
+
+  static ShardOutput Read(const std::string &file, std::string *shard = nullptr) {
+    std::unique_ptr<TFile> in(TFile::Open(file.c_str()));
+    if (!in || in->IsZombie()) throw std::runtime_error("ShardOutput: cannot read " + file);
+    ShardOutput output;
+    auto *histograms = in->Get<TNamed>("histograms");
+    auto *counts = in->Get<TList>("counts");
+    auto *cutFlows = in->Get<TList>("cutflows");
+    auto *label = in->Get<TNamed>("shard");
+    if (!histograms || !counts || !cutFlows || !label)
+      throw std::runtime_error("ShardOutput: " + file + " is not a shard output");
+    for (const auto &name : Lines(histograms->GetTitle())) {
+      std::unique_ptr<TH1D> h(in->Get<TH1D>(name.c_str()));
+      if (!h) throw std::runtime_error("ShardOutput: no histogram " + name + " in " + file);
+      output.Add(name, *h);
+    }
+    for (TObject *count : *counts)
+      output.AddCount(count->GetName(), static_cast<TParameter<Long64_t> *>(count)->GetVal());
+    for (TObject *flow : *cutFlows) output.fCutFlows.emplace_back(flow->GetName(), Lines(flow->GetTitle()));
+    if (shard) *shard = label->GetTitle();
+    delete histograms;
+    delete counts;
+    delete cutFlows;
+    delete label;
+    return output;
+  }
+
+  // Add other, which must have the same histograms, counts and cut flows
+  void Merge(const ShardOutput &other) {
+    if (!SameContent(other)) throw std::runtime_error("ShardOutput: cannot merge outputs with different content");
+    for (size_t i = 0; i < fHistograms.size(); i++) fHistograms[i].second->Add(other.fHistograms[i].second.get());
+    for (size_t i = 0; i < fCounts.size(); i++) fCounts[i].second += other.fCounts[i].second;
+  }
+
+  // Append the histograms, counts and cut flows of other, e.g. of another
+  // sample, which must not be in this output
+  void Append(ShardOutput &&other) {
+    for (auto &h : other.fHistograms) {
+      for (const auto &mine : fHistograms)
+        if (mine.first == h.first) throw std::runtime_error("ShardOutput: histogram " + h.first + " appended twice");
+      fHistograms.push_back(std::move(h));
+    }
+    fCounts.insert(fCounts.end(), other.fCounts.begin(), other.fCounts.end());
+    fCutFlows.insert(fCutFlows.end(), other.fCutFlows.begin(), other.fCutFlows.end());
+    other = ShardOutput();
+  }
+
+  // Sum of the files <prefix>_shard<i>of<n>.root, i = 0 ... n-1, added in shard order
+  static ShardOutput Merge(const std::string &prefix, unsigned int count) {
+    ShardOutput merged;
+    for (unsigned int i = 0; i < count; i++) {
+      const std::string file = Shard::FileName(prefix, i, count);
+      std::string label;
+      ShardOutput output = Read(file, &label);
+      if (label != Shard(i, count).Label())
+        throw std::runtime_error("ShardOutput: " + file + " contains shard " + label);
+      if (i == 0)
+        merged = std::move(output);
+      else
+        merged.Merge(output);
+    }
+    std::printf("merged %u shards of %s\n", count, prefix.c_str());
+    return merged;
+  }
+
+  // Compare with other: counts and unweighted histograms must be equal, sums
+  // of weights equal within the relative tolerance. Prints the differences.
+  bool Compare(const ShardOutput &other, double tolerance = 1e-10) const {
+    if (!SameContent(other)) {
+      std::printf("different histograms, counts or cut flows\n");
+      return false;
+    }
+    int differences = 0;
+    for (size_t i = 0; i < fCounts.size(); i++)
+      if (fCounts[i].second != other.fCounts[i].second) {
+        std::printf("count %s: %llu != %llu\n", fCounts[i].first.c_str(), fCounts[i].second, other.fCounts[i].second);
+        differences++;
+      }
+    for (size_t i = 0; i < fHistograms.size(); i++) {
+      const TH1D &a = *fHistograms[i].second, &b = *other.fHistograms[i].second;
+      if (a.GetNcells() != b.GetNcells() || a.GetEntries() != b.GetEntries()) {
+        std::printf("histogram %s: different binning or entries\n", fHistograms[i].first.c_str());
+        differences++;
+        continue;
+      }
+      for (int bin = 0; bin < a.GetNcells(); bin++) {
+        const double x = a.GetBinContent(bin), y = b.GetBinContent(bin);
+        if (std::abs(x - y) > tolerance * std::max(std::abs(x), std::abs(y))) {
+          std::printf("histogram %s, bin %d: %.17g != %.17g\n", fHistograms[i].first.c_str(), bin, x, y);
+          differences++;
+          break;
+        }
+      }
+    }
+    return differences == 0;
+  }
+
+private:
+  // the lines of text, each terminated by a newline
+  static std::vector<std::string> Lines(const std::string &text) {
+    std::vector<std::string> lines;
+    for (size_t begin = 0, end; (end = text.find('\n', begin)) != std::string::npos; begin = end + 1)
+      lines.push_back(text.substr(begin, end - begin));
+    return lines;
+  }
+
+  static std::string CutKey(const std::string &title, const std::string &cut, const char *what) {
+    return "cutflow " + title + ": " + cut + ": " + what;
+  }
+
+  bool SameContent(const ShardOutput &other) const {
+    if (fHistograms.size() != other.fHistograms.size() || fCounts.size() != other.fCounts.size() ||
+        fCutFlows != other.fCutFlows)
+      return false;
+    for (size_t i = 0; i < fHistograms.size(); i++)
+      if (fHistograms[i].first != other.fHistograms[i].first) return false;
+    for (size_t i = 0; i < fCounts.size(); i++)
+      if (fCounts[i].first != other.fCounts[i].first) return false;
+    return true;
+  }
+
+  std::vector<std::pair<std::string, std::unique_ptr<TH1D>>> fHistograms;
+  std::vector<std::pair<std::string, ULong64_t>> fCounts;
+  std::vector<std::pair<std::string, std::vector<std::string>>> fCutFlows;  // title and names of the cuts
+};
+
+#endif
@@ -0,0 +1,182 @@
+// Local cache of skimmed NanoAODRun1 files.
+//
+// The first time an input file is used, the events passing a preselection
+// (e.g. "nMuon >= 2") are written with only the columns an analysis needs
+// into a compressed file in a local cache directory. Later runs with the
+// same input, preselection and columns find this file and read it instead of
+// the original one, so that e.g. re-styling or re-binning a plot does not
+// need another pass over the full input.
+//
+// A cache file is identified by a hash of the input file name, UUID and size,
+// the preselection and the column list, which is part of its file name and is
+// also stored inside the file. Changing any of them, e.g. regenerating a local
+// input file under the same name, writes a new cache file.
+//
+// The preselection is a filter expression, which RDataFrame compiles when the
+// cache is written, or a function that books a compiled filter instead; the
+// expression then only identifies the cache files and has to describe the
+// filter.
+//
+// Usage:
+//   SkimCache cache("nMuon >= 2", {"nMuon", "Muon_pt", ...});
+//   ROOT::RDataFrame df("Events", cache.Files("Events", {"root://.../Run2012B_DoubleMuParked_merged.root", ...}));
+//   SkimCache compiled("nMuon >= 2", [](ROOT::RDF::RNode df) { return df.Filter(TwoMuons, {"nMuon"}, "Skim"); },
+//                      {"nMuon", "Muon_pt", ...});
+//
+// Cut flow reports of a cached run start from the preselected events;
+// InputEntries() is the number of events of the original files.
+
+#ifndef NANOAODRUN1_SKIMCACHE_H
+#define NANOAODRUN1_SKIMCACHE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Compression.h"
+#include "ROOT/RDataFrame.hxx"
+#include "TChain.h"
+#include "TFile.h"
+#include "TNamed.h"
+#include "TParameter.h"
+#include "TSystem.h"
+#include "TTree.h"
+
+class SkimCache {
+public:
+  // Books the preselection on the events of an input file
+  using Preselection = std::function<ROOT::RDF::RNode(ROOT::RDF::RNode)>;
+
+  SkimCache(std::string selection, std::vector<std::string> columns, std::string directory = "skimcache")
+    : fSelection(std::move(selection)), fColumns(std::move(columns)), fDirectory(std::move(directory)) {}
+  SkimCache(std::string selection, Preselection preselection, std::vector<std::string> columns,
+            std::string directory = "skimcache")
+    : fSelection(std::move(selection)), fPreselection(std::move(preselection)), fColumns(std::move(columns)),
+      fDirectory(std::move(directory)) {}
+
+  // Cached files for the inputs (which may contain wildcards), in input
+  // order. Inputs that are not cached yet are skimmed first.
+  std::vector<std::string> Files(const std::string &treeName, const std::vector<std::string> &inputs) {
+    fInputEntries = 0;
+    fCachedEntries = 0;
+    std::vector<std::string> files;
+    for (const auto &input : Expand(treeName, inputs)) {
+      const std::string key = Key(treeName, input);
+      const std::string file = fDirectory + "/" + BaseName(input) + "_" + Hash(key) + ".root";
+      if (!Valid(file, treeName, key)) Skim(treeName, input, file, key);
+      files.push_back(file);
+    }
+    return files;
+  }
+
+  // Number of events of the original inputs and of the cached files of the last Files() call
+  Long64_t InputEntries() const { return fInputEntries; }
+  Long64_t CachedEntries() const { return fCachedEntries; }
+
+  // The helpers below are also used by the result store (see ResultStore.h)
+
+  // Individual file names of the inputs, with wildcards resolved by TChain
+  static std::vector<std::string> Expand(const std::string &treeName, const std::vector<std::string> &inputs) {
+    std::vector<std::string> files;
+    for (const auto &input : inputs) {
+      if (input.find_first_of("*?[") == std::string::npos) {
+        files.push_back(input);
+        continue;
+      }
+      TChain chain(treeName.c_str());
+      chain.Add(input.c_str());
+      for (auto *element : *chain.GetListOfFiles()) files.push_back(element->GetTitle());
+    }
+    return files;
+  }
+
+  // 64 bit FNV-1a hash, as 16 hex digits
+  static std::string Hash(const std::string &text) {
+    std::uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+    return hex;
+  }
+
+  static std::string BaseName(const std::string &input) {
+    std::string name = gSystem->BaseName(input.c_str());
+    if (name.size() > 5 && name.compare(name.size() - 5, 5, ".root") == 0) name.resize(name.size() - 5);
+    return name;
+  }
+
+private:
+  static constexpr const char *kVersion = "2";
+
+  // Opens the input for its UUID and size, like ResultStore::Key
+  std::string Key(const std::string &treeName, const std::string &input) const {
+    std::unique_ptr<TFile> f(TFile::Open(input.c_str()));
+    if (!f || f->IsZombie()) throw std::runtime_error("SkimCache: cannot open " + input);
+    std::string key = std::string("SkimCache v") + kVersion + "\ninput: " + input + "\nuuid: " +
+                      f->GetUUID().AsString() + "\nsize: " + std::to_string(f->GetSize()) + "\ntree: " + treeName +
+                      "\nselection: " + fSelection + "\ncolumns:";
+    for (const auto &column : fColumns) key += " " + column;
+    return key;
+  }
+
+  // Is file a complete cache file for this key? Add its entry counts if so.
+  bool Valid(const std::string &file, const std::string &treeName, const std::string &key) {
+    if (gSystem->AccessPathName(file.c_str())) return false;
+    std::unique_ptr<TFile> f(TFile::Open(file.c_str()));
+    if (!f || f->IsZombie()) return false;
+    auto *stored = f->Get<TNamed>("SkimCacheKey");
+    auto *entries = f->Get<TParameter<Long64_t>>("SkimCacheInputEntries");
+    auto *tree = f->Get<TTree>(treeName.c_str());
+    if (!stored || !entries || !tree || key != stored->GetTitle()) return false;
+    fInputEntries += entries->GetVal();
+    fCachedEntries += tree->GetEntries();
+    return true;
+  }
+
+  // Write the preselected events of input to file. The file is written under a
+  // temporary name and renamed when complete, so that an interrupted skim is
+  // never taken for a cache file.
+  void Skim(const std::string &treeName, const std::string &input, const std::string &file, const std::string &key) {
+    gSystem->mkdir(fDirectory.c_str(), true);
+    const std::string tmp = file + ".part";
+    std::printf("skimming %s into %s\n", input.c_str(), file.c_str());
+
+    ROOT::RDataFrame df(treeName, input);
+    auto total = df.Count();
+    ROOT::RDF::RSnapshotOptions options;
+    options.fCompressionAlgorithm = ROOT::RCompressionSetting::EAlgorithm::kZSTD;
+    options.fCompressionLevel = 5;
+    ROOT::RDF::RNode skimmed =
+      fPreselection ? fPreselection(ROOT::RDF::RNode(df)) : ROOT::RDF::RNode(df.Filter(fSelection, "Skim"));
+    auto selected = skimmed.Count();
+    skimmed.Snapshot(treeName, tmp, fColumns, options);  // runs the event loop
+
+    {
+      std::unique_ptr<TFile> f(TFile::Open(tmp.c_str(), "UPDATE"));
+      if (!f || f->IsZombie()) throw std::runtime_error("SkimCache: cannot update " + tmp);
+      TNamed stored("SkimCacheKey", key.c_str());
+      TParameter<Long64_t> entries("SkimCacheInputEntries", *total);
+      stored.Write();
+      entries.Write();
+    }
+    if (gSystem->Rename(tmp.c_str(), file.c_str()) != 0)
+      throw std::runtime_error("SkimCache: cannot rename " + tmp + " to " + file);
+    fInputEntries += *total;
+    fCachedEntries += *selected;
+  }
+
+  std::string fSelection;
+  Preselection fPreselection;  // instead of Filter(fSelection), if set
+  std::vector<std::string> fColumns;
+  std::string fDirectory;
+  Long64_t fInputEntries = 0;
+  Long64_t fCachedEntries = 0;
+};
+
+#endif
@@ -0,0 +1,327 @@
+// Throughput measurements of the examples, written to a JSON file.
+//
+// Records the wall and CPU time of the whole macro and of its stages, the
+// number of events and their rate, the bytes read from all ROOT files, the
+// time spent reading and decompressing baskets (from TTreePerfStats, where a
+// macro has its own TTree loop), the time spent in individual RDataFrame
+// filters, and the cut flows of the macro. In executables built with
+// NANOAODRUN1_COUNT_ALLOCATIONS (see AllocationCounter.h), the heap
+// allocations of every stage are counted too, and those of the stages named
+// "event loop..." are given per event. Print() shows a summary and
+// Write() stores everything in <macro>_throughput.json, so that runs with
+// different ROOT versions or on different machines can be compared.
+//
+// Usage:
+//   Throughput throughput("MyMacro", nThreads);
+//   {
+//     auto stage = throughput.Stage("event loop");   // timed until the end of the scope
+//     ... df.Filter(throughput.Timed("pt cut", [](float pt) { return pt > 3; }), {"pt"}, "pt cut") ...
+//   }
+//   throughput.SetEvents(nEvents);
+//   throughput.AddCutFlow(report);       // RCutFlowReport of an RDataFrame
+//   throughput.AddIOStats(perfStats);    // TTreePerfStats of a TTree loop
+//   throughput.Print();
+//   throughput.Write();
+
+#ifndef NANOAODRUN1_THROUGHPUT_H
+#define NANOAODRUN1_THROUGHPUT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "ROOT/RCutFlowReport.hxx"
+#include "ROOT/TypeTraits.hxx"
+#include "TFile.h"
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TTreePerfStats.h"
+#include "AllocationCounter.h"
+
+class Throughput {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Times a stage of the macro from construction until Stop() or destruction
+  class StageTimer {
+  public:
+    StageTimer(Throughput &owner, std::string name)
+      : fOwner(&owner), fName(std::move(name)), fStart(Clock::now()), fAllocations(AllocationCounter::Count()) {}
+    StageTimer(StageTimer &&other) noexcept
+      : fOwner(other.fOwner), fName(std::move(other.fName)), fStart(other.fStart), fAllocations(other.fAllocations) {
+      other.fOwner = nullptr;
+    }
+    StageTimer(const StageTimer &) = delete;
+    ~StageTimer() { Stop(); }
+    void Stop() {
+      if (!fOwner) return;
+      fOwner->AddStage(fName, std::chrono::duration<double>(Clock::now() - fStart).count(),
+                       AllocationCounter::Count() - fAllocations);
+      fOwner = nullptr;
+    }
+
+  private:
+    Throughput *fOwner;
+    std::string fName;
+    Clock::time_point fStart;
+    ULong64_t fAllocations;  // count at the start
+  };
+
+  explicit Throughput(std::string macro, unsigned int nThreads = 1)
+    : fMacro(std::move(macro)), fThreads(nThreads), fStart(Clock::now()), fCpuStart(CpuSeconds()),
+      fBytesStart(TFile::GetFileBytesRead()), fStartTime(std::time(nullptr)),
+      fAllocationsStart(AllocationCounter::Count()) {}
+
+  StageTimer Stage(const std::string &name) { return StageTimer(*this, name); }
+
+  // Stages and timed callables of the same name (e.g. the event loops of
+  // several files) are summed
+  void AddStage(const std::string &name, double seconds, ULong64_t allocations = 0) {
+    std::lock_guard<std::mutex> lock(fMutex);
+    for (auto &stage : fStages)
+      if (stage.name == name) {
+        stage.seconds += seconds;
+        stage.allocations += allocations;
+        return;
+      }
+    fStages.push_back({name, seconds, allocations});
+  }
+
+  void SetEvents(ULong64_t n) { fEvents = n; }
+
+  // Wrap a filter (or define) callable so that the time spent in it is
+  // recorded under name. The wrapper has the same signature as the callable;
+  // each thread adds to its own counter.
+  template <typename F>
+  auto Timed(const std::string &name, F f) {
+    return MakeTimed(std::move(f), NewTimer(name), typename ROOT::TypeTraits::CallableTraits<F>::arg_types_nodecay{});
+  }
+
+  // Add the basket read and decompression times of a TTree loop; can be
+  // called once per thread, the numbers are summed
+  void AddIOStats(TTreePerfStats &stats) {
+    stats.Finish();
+    std::lock_guard<std::mutex> lock(fMutex);
+    fIO.count++;
+    fIO.readCalls += stats.GetReadCalls();
+    fIO.bytesRead += stats.GetBytesRead();
+    fIO.diskSeconds += stats.GetDiskTime();
+    fIO.unzipSeconds += stats.GetUnzipTime();
+    fIO.cpuSeconds += stats.GetCpuTime();
+    fIO.realSeconds += stats.GetRealTime();
+  }
+
+  // Add all cuts of an RDataFrame cut flow report, or a single cut
+  void AddCutFlow(const ROOT::RDF::RCutFlowReport &report) {
+    for (const auto &cut : report) AddCut(cut.GetName(), cut.GetPass(), cut.GetAll());
+  }
+  void AddCut(const std::string &name, ULong64_t pass, ULong64_t all) {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fCuts.push_back({name, pass, all});
+  }
+
+  double WallSeconds() const { return std::chrono::duration<double>(Clock::now() - fStart).count(); }
+
+  void Print() const {
+    const double wall = WallSeconds();
+    const double megabytes = BytesRead() / 1e6;
+    std::printf("%s: %llu events in %.1f s (%.0f events/s), %.1f MB read (%.1f MB/s), %u threads, CPU %.1f s\n",
+                fMacro.c_str(), fEvents, wall, wall > 0 ? fEvents / wall : 0., megabytes,
+                wall > 0 ? megabytes / wall : 0., fThreads, CpuSeconds() - fCpuStart);
+    for (const auto &stage : fStages) {
+      std::printf("  stage  %-32s %10.3f s", stage.name.c_str(), stage.seconds);
+      if (AllocationCounter::Enabled()) std::printf(" %12llu allocations", stage.allocations);
+      std::printf("\n");
+    }
+    if (AllocationCounter::Enabled())
+      std::printf("  heap   %llu allocations, %.4f per event in the event loops\n", Allocations(),
+                  LoopAllocationsPerEvent());
+    if (fIO.count)
+      std::printf("  I/O    read %.3f s, decompress %.3f s, user code %.3f s (summed over %d loops)\n",
+                  fIO.diskSeconds, fIO.unzipSeconds, UserSeconds(), fIO.count);
+    for (const auto &timer : fTimers)
+      std::printf("  filter %-32s %10.3f s in %llu calls\n", timer.name.c_str(), timer.Seconds(), timer.Calls());
+  }
+
+  // Write all numbers to a JSON file, by default <macro>_throughput.json
+  void Write(std::string file = "") const {
+    if (file.empty()) file = fMacro + "_throughput.json";
+    std::FILE *out = std::fopen(file.c_str(), "w");
+    if (!out) {
+      std::printf("Throughput: cannot write %s\n", file.c_str());
+      return;
+    }
+    const double wall = WallSeconds();
+    char date[32];
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&fStartTime));
+    std::fprintf(out, "{\n");
+    std::fprintf(out, "  \"macro\": %s,\n", Quote(fMacro).c_str());
+    std::fprintf(out, "  \"root_version\": %s,\n", Quote(gROOT->GetVersion()).c_str());
+    std::fprintf(out, "  \"host\": %s,\n", Quote(gSystem->HostName()).c_str());
+    std::fprintf(out, "  \"start\": %s,\n", Quote(date).c_str());
+    std::fprintf(out, "  \"threads\": %u,\n", fThreads);
+    std::fprintf(out, "  \"wall_seconds\": %.6f,\n", wall);
+    std::fprintf(out, "  \"cpu_seconds\": %.6f,\n", CpuSeconds() - fCpuStart);
+    std::fprintf(out, "  \"events\": %llu,\n", fEvents);
+    std::fprintf(out, "  \"events_per_second\": %.3f,\n", wall > 0 ? fEvents / wall : 0.);
+    std::fprintf(out, "  \"bytes_read\": %lld,\n", BytesRead());
+    std::fprintf(out, "  \"megabytes_per_second\": %.3f,\n", wall > 0 ? BytesRead() / 1e6 / wall : 0.);
+    if (AllocationCounter::Enabled()) {
+      std::fprintf(out, "  \"allocations\": %llu,\n", Allocations());
+      std::fprintf(out, "  \"event_loop_allocations_per_event\": %.6f,\n", LoopAllocationsPerEvent());
+    }
+    if (fIO.count) {
+      std::fprintf(out, "  \"io\": {\"loops\": %d, \"read_calls\": %lld, \"bytes_read\": %lld, \"read_seconds\": %.6f, "
+                        "\"decompress_seconds\": %.6f, \"user_seconds\": %.6f, \"loop_seconds\": %.6f},\n",
+                   fIO.count, fIO.readCalls, fIO.bytesRead, fIO.diskSeconds, fIO.unzipSeconds, UserSeconds(),
+                   fIO.realSeconds);
+    }
+    std::fprintf(out, "  \"stages\": [");
+    for (size_t i = 0; i < fStages.size(); i++) {
+      std::fprintf(out, "%s\n    {\"name\": %s, \"seconds\": %.6f", i ? "," : "", Quote(fStages[i].name).c_str(),
+                   fStages[i].seconds);
+      if (AllocationCounter::Enabled()) std::fprintf(out, ", \"allocations\": %llu", fStages[i].allocations);
+      std::fprintf(out, "}");
+    }
+    std::fprintf(out, "%s],\n", fStages.empty() ? "" : "\n  ");
+    std::fprintf(out, "  \"filters\": [");
+    size_t i = 0;
+    for (const auto &timer : fTimers)
+      std::fprintf(out, "%s\n    {\"name\": %s, \"seconds\": %.6f, \"calls\": %llu}", i++ ? "," : "",
+                   Quote(timer.name).c_str(), timer.Seconds(), timer.Calls());
+    std::fprintf(out, "%s],\n", fTimers.empty() ? "" : "\n  ");
+    std::fprintf(out, "  \"cutflow\": [");
+    for (size_t c = 0; c < fCuts.size(); c++)
+      std::fprintf(out, "%s\n    {\"name\": %s, \"pass\": %llu, \"all\": %llu}", c ? "," : "",
+                   Quote(fCuts[c].name).c_str(), fCuts[c].pass, fCuts[c].all);
+    std::fprintf(out, "%s]\n}\n", fCuts.empty() ? "" : "\n  ");
+    std::fclose(out);
+    std::printf("throughput written to %s\n", file.c_str());
+  }
+
+private:
+  static constexpr unsigned int kMaxThreads = 256;
+
+  // Per-thread time and call counters of a timed callable, one cache line each
+  struct Timer {
+    struct alignas(64) Counter {
+      std::atomic<ULong64_t> nanoseconds{0};
+      std::atomic<ULong64_t> calls{0};
+    };
+    explicit Timer(std::string n) : name(std::move(n)), counters(kMaxThreads) {}
+    void Add(ULong64_t ns) {
+      auto &counter = counters[ThreadIndex()];
+      counter.nanoseconds.store(counter.nanoseconds.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+      counter.calls.store(counter.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    double Seconds() const {
+      ULong64_t sum = 0;
+      for (const auto &counter : counters) sum += counter.nanoseconds.load(std::memory_order_relaxed);
+      return sum * 1e-9;
+    }
+    ULong64_t Calls() const {
+      ULong64_t sum = 0;
+      for (const auto &counter : counters) sum += counter.calls.load(std::memory_order_relaxed);
+      return sum;
+    }
+    std::string name;
+    std::vector<Counter> counters;
+  };
+
+  struct StageTime {
+    std::string name;
+    double seconds;
+    ULong64_t allocations;
+  };
+  struct Cut {
+    std::string name;
+    ULong64_t pass, all;
+  };
+  struct IOStats {
+    int count = 0;
+    Long64_t readCalls = 0, bytesRead = 0;
+    double diskSeconds = 0, unzipSeconds = 0, cpuSeconds = 0, realSeconds = 0;
+  };
+
+  // Small index of the calling thread, to pick its counter
+  static unsigned int ThreadIndex() {
+    static std::atomic<unsigned int> next{0};
+    thread_local unsigned int index = next++ % kMaxThreads;
+    return index;
+  }
+
+  Timer *NewTimer(const std::string &name) {
+    std::lock_guard<std::mutex> lock(fMutex);
+    for (auto &timer : fTimers)
+      if (timer.name == name) return &timer;
+    fTimers.emplace_back(name);
+    return &fTimers.back();
+  }
+
+  template <typename F, typename... Args>
+  static auto MakeTimed(F f, Timer *timer, ROOT::TypeTraits::TypeList<Args...>) {
+    return [f, timer](Args... args) {
+      const auto start = Clock::now();
+      auto result = f(args...);
+      timer->Add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+      return result;
+    };
+  }
+
+  static double CpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+  }
+
+  Long64_t BytesRead() const { return TFile::GetFileBytesRead() - fBytesStart; }
+
+  ULong64_t Allocations() const { return AllocationCounter::Count() - fAllocationsStart; }
+
+  // allocations of the "event loop..." stages per event; setup costs such as
+  // the readers of every task are included, so only values close to 0 mean
+  // that the loops do not allocate per event
+  double LoopAllocationsPerEvent() const {
+    ULong64_t allocations = 0;
+    for (const auto &stage : fStages)
+      if (stage.name.compare(0, 10, "event loop") == 0) allocations += stage.allocations;
+    return fEvents ? double(allocations) / fEvents : 0.;
+  }
+
+  // time of the TTree loops not spent reading or decompressing
+  double UserSeconds() const { return fIO.realSeconds - fIO.diskSeconds - fIO.unzipSeconds; }
+
+  static std::string Quote(const std::string &text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+      if (c == '"' || c == '\\') quoted += '\\';
+      if (c == '\n') {
+        quoted += "\\n";
+        continue;
+      }
+      quoted += c;
+    }
+    return quoted + "\"";
+  }
+
+  std::string fMacro;
+  unsigned int fThreads;
+  Clock::time_point fStart;
+  double fCpuStart;
+  Long64_t fBytesStart;
+  std::time_t fStartTime;
+  ULong64_t fAllocationsStart;
+  ULong64_t fEvents = 0;
+  std::mutex fMutex;
+  std::vector<StageTime> fStages;
+  std::deque<Timer> fTimers;
+  std::vector<Cut> fCuts;
+  IOStats fIO;
+};
+
+#endif
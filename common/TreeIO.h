@@ -0,0 +1,183 @@
+// Read-ahead configuration of the TTree/TChain loops of the examples.
+//
+// Without a configured TTreeCache, every basket of every branch is a separate
+// synchronous read, which on remote (XRootD) files costs one network round trip
+// each. TreeIO::Configure sets up the cache of a loop such that
+//   - the cache holds the baskets of the branches the loop reads, for a few
+//     clusters of entries, and is sized from their compressed size per entry,
+//   - these branches are known from the start (no learning phase), and the
+//     cache only reads within the entry range of the loop,
+//   - the next block of the cache is fetched in a background thread while the
+//     current one is processed (asynchronous prefetching, on by default for
+//     remote files),
+//   - the baskets of the cache are decompressed in background tasks ahead of
+//     the loop (TTreeCacheUnzip, on by default if ROOT's implicit
+//     multithreading is enabled, whose thread pool runs these tasks).
+//
+// The settings can be changed in the code or with environment variables:
+//   NANOAODRUN1_CACHE_MB         cache size in MB (0 disables the cache)
+//   NANOAODRUN1_CACHE_CLUSTERS   clusters held by an automatically sized cache
+//   NANOAODRUN1_PREFETCH         0 or 1: asynchronous prefetching
+//   NANOAODRUN1_PARALLEL_UNZIP   0 or 1: decompression in background tasks
+//
+// Prefetching and parallel decompression are global modes of ROOT, which are
+// set once from the main thread, before the event loops start (and after
+// ROOT::EnableImplicitMT, on which the default of parallel decompression
+// depends):
+//   TreeIO::SetGlobalOptions(chain);
+//
+// Usage, after the branches of the loop have been enabled:
+//   TreeIO::Configure(chain, first, last);   // entries [first, last)
+//   TreeIO::Print(chain);                    // shows the settings
+//   for (Long64_t i = first; i < last; i++) chain->GetEntry(i);
+// or, for loops that do not disable the other branches (e.g. TTreeReader),
+//   TreeIO::Configure(chain, 0, chain->GetEntries(), TreeIOOptions::FromEnv(), {"run", "Muon_pt"});
+
+#ifndef NANOAODRUN1_TREEIO_H
+#define NANOAODRUN1_TREEIO_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "TBranch.h"
+#include "TChain.h"
+#include "TEnv.h"
+#include "TFile.h"
+#include "TObjArray.h"
+#include "TROOT.h"
+#include "TTree.h"
+#include "TTreeCache.h"
+#include "TTreeCacheUnzip.h"
+#include "TUrl.h"
+
+struct TreeIOOptions {
+  Long64_t cacheBytes = -1;  // cache size; -1: sized from the branches read, 0: no cache
+  int clusters = 2;          // clusters of entries held by an automatically sized cache
+  int prefetch = -1;         // asynchronous prefetching: 1 on, 0 off, -1 for remote files only
+  int parallelUnzip = -1;    // background decompression: 1 on, 0 off, -1 if implicit MT is enabled
+
+  // Defaults, overridden by the NANOAODRUN1_* environment variables
+  static TreeIOOptions FromEnv() {
+    TreeIOOptions options;
+    if (const char *mb = std::getenv("NANOAODRUN1_CACHE_MB")) options.cacheBytes = Long64_t(std::atof(mb) * 1024 * 1024);
+    if (const char *n = std::getenv("NANOAODRUN1_CACHE_CLUSTERS")) options.clusters = std::max(1, std::atoi(n));
+    if (const char *on = std::getenv("NANOAODRUN1_PREFETCH")) options.prefetch = std::atoi(on) != 0;
+    if (const char *on = std::getenv("NANOAODRUN1_PARALLEL_UNZIP")) options.parallelUnzip = std::atoi(on) != 0;
+    return options;
+  }
+};
+
+namespace TreeIO {
+
+// limits of an automatically sized cache
+constexpr Long64_t kMinCacheBytes = 4 << 20;
+constexpr Long64_t kMaxCacheBytes = 1024LL << 20;
+
+// Names of the enabled top-level branches of the (current tree of the) tree
+inline std::vector<std::string> ActiveBranches(TTree *tree) {
+  std::vector<std::string> names;
+  for (TObject *obj : *tree->GetListOfBranches()) {
+    auto *branch = static_cast<TBranch *>(obj);
+    if (!branch->TestBit(TBranch::kDoNotProcess)) names.push_back(branch->GetName());
+  }
+  return names;
+}
+
+// Compressed bytes per entry of the branches
+inline double BytesPerEntry(TTree *tree, const std::vector<std::string> &branches) {
+  if (tree->GetEntries() <= 0) return 0;
+  Long64_t bytes = 0;
+  for (const auto &name : branches)
+    if (TBranch *branch = tree->GetBranch(name.c_str())) bytes += branch->GetZipBytes("*");
+  return double(bytes) / tree->GetEntries();
+}
+
+// Number of entries of the cluster containing entry
+inline Long64_t ClusterEntries(TTree *tree, Long64_t entry) {
+  auto clusters = tree->GetClusterIterator(entry);
+  Long64_t start = clusters();
+  return std::max<Long64_t>(1, std::min(clusters.GetNextEntry(), tree->GetEntries()) - start);
+}
+
+inline bool IsRemote(TTree *tree) {
+  TFile *file = tree->GetCurrentFile();
+  if (!file) return false;
+  const std::string protocol = file->GetEndpointUrl()->GetProtocol();
+  return protocol != "file" && !protocol.empty();
+}
+
+// Whether the first file of a chain, or the file of a tree, is remote, from its
+// name (without opening it)
+inline bool IsRemoteInput(TTree *tree) {
+  auto *chain = dynamic_cast<TChain *>(tree);
+  if (!chain) return IsRemote(tree);
+  TObjArray *files = chain->GetListOfFiles();
+  if (!files || files->GetEntries() == 0) return false;
+  const std::string protocol = TUrl(files->At(0)->GetTitle()).GetProtocol();
+  return protocol != "file" && !protocol.empty();
+}
+
+// Set asynchronous prefetching and parallel decompression for the caches of
+// all files. ROOT reads both modes when the cache of a file is created, and
+// gEnv is not thread-safe, so this is called once from the main thread before
+// the event loops start, with the input of the loops (which all read the same
+// kind of input with the same options).
+inline void SetGlobalOptions(TTree *tree, const TreeIOOptions &options = TreeIOOptions::FromEnv()) {
+  const bool prefetch = options.prefetch < 0 ? IsRemoteInput(tree) : options.prefetch != 0;
+  gEnv->SetValue("TFile.AsyncPrefetching", prefetch ? 1 : 0);
+  const bool unzip = options.parallelUnzip < 0 ? ROOT::IsImplicitMTEnabled() : options.parallelUnzip != 0;
+  TTreeCacheUnzip::SetParallelUnzip(unzip ? TTreeCacheUnzip::kEnable : TTreeCacheUnzip::kDisable);
+}
+
+// Cache size for reading the branches of tree from entry on
+inline Long64_t CacheBytes(TTree *tree, Long64_t entry, const std::vector<std::string> &branches,
+                           const TreeIOOptions &options) {
+  if (options.cacheBytes >= 0) return options.cacheBytes;
+  const double bytes = BytesPerEntry(tree, branches) * ClusterEntries(tree, entry) * options.clusters;
+  return std::min(kMaxCacheBytes, std::max(kMinCacheBytes, Long64_t(bytes)));
+}
+
+// Set up the cache of tree (a TTree or TChain) for reading the entries [first, last)
+// of the given branches (by default all enabled branches), with the global
+// modes of SetGlobalOptions. Loops in parallel threads call it for their own
+// trees.
+inline void Configure(TTree *tree, Long64_t first, Long64_t last, const TreeIOOptions &options = TreeIOOptions::FromEnv(),
+                      std::vector<std::string> branches = {}) {
+  if (tree->LoadTree(first) < 0) return;
+  TTree *current = tree->GetTree();
+  if (branches.empty()) branches = ActiveBranches(current);
+
+  const Long64_t cacheBytes = CacheBytes(current, tree->LoadTree(first), branches, options);
+  if (cacheBytes == 0) {
+    tree->SetCacheSize(0);
+    return;
+  }
+  tree->SetCacheSize(cacheBytes);
+  tree->SetCacheEntryRange(first, last);
+  for (const auto &name : branches) tree->AddBranchToCache(name.c_str(), kTRUE);
+  tree->StopCacheLearningPhase();
+}
+
+// Print the cache settings of the current file of tree
+inline void Print(TTree *tree) {
+  TFile *file = tree->GetCurrentFile();
+  auto *cache = file ? dynamic_cast<TTreeCache *>(file->GetCacheRead(tree->GetTree())) : nullptr;
+  if (!cache) {
+    std::printf("TreeIO: no cache for %s\n", tree->GetName());
+    return;
+  }
+  std::vector<std::string> cached;
+  for (TObject *branch : *cache->GetCachedBranches()) cached.push_back(branch->GetName());
+  std::printf("TreeIO: %s: cache of %.1f MB for %zu branches (%.1f kB per entry), %s, %s, %s\n", tree->GetName(),
+              cache->GetBufferSize() / 1048576., cached.size(), BytesPerEntry(tree->GetTree(), cached) / 1024.,
+              gEnv->GetValue("TFile.AsyncPrefetching", 0) ? "asynchronous prefetching" : "synchronous reads",
+              dynamic_cast<TTreeCacheUnzip *>(cache) && TTreeCacheUnzip::IsParallelUnzip() ? "parallel unzip"
+                                                                                             : "unzip in the loop",
+              IsRemote(tree->GetTree()) ? "remote file" : "local file");
+}
+
+} // namespace TreeIO
+
+#endif
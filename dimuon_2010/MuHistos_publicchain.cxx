@@ -1,13 +1,19 @@
 // This macro is use to convert nanoAOD(plus) ntuple to histograms
 // that can be compared to Open Data 2010 MuMonitor validation plots
 // Usage: root -l MuHistos_eospublic.cxx++
+//    or: the MuHistos_publicchain executable of the CMake build
 
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
 #include "TH1.h"
 #include "TCanvas.h"
 #include "TPad.h"
-#include "stdlib.h" 
+#include "stdlib.h"
 #include "TStyle.h"
 #include "TGraph.h"
 #include "TAxis.h"
@@ -22,67 +28,215 @@
 #include "TBufferFile.h"
 #include "TLorentzVector.h"
 #include "TPaveStats.h"
+#include "TTreePerfStats.h"
+#include "../common/MuonCollection.h"
+#include "../common/DimuonMass.h"
+#include "../common/HistogramBank.h"
+#include "../common/LogMassHistogram.h"
+#include "../common/ExactSum.h"
+#include "../common/MassCandidateStore.h"
+#include "../common/Throughput.h"
+#include "../common/NanoAODRun1Input.h"
+#include "../common/TreeIO.h"
+#include "../common/ChainScheduler.h"
+#include "../common/Progress.h"
+
+using namespace std;
+
+// Number of worker threads for the event loop. The threads take ranges of
+// entries of the input files from a shared scheduler (see
+// common/ChainScheduler.h) and fill their own bank of the histograms (see
+// common/HistogramBank.h), and the banks are merged at the end. Set to 1 to run the plain serial event loop.
+// The environment variable NANOAODRUN1_NTHREADS overrides it.
+#define defaultThreads 12
+
+// Set to 1 to also write the mass of every dimuon pair to a candidate file
+// (see common/MassCandidateStore.h), from which tools/refillMassHistogram.C
+// can fill other mass binnings without running the event loop again.
+#define writeMassCandidates 0
+
+// All histograms filled by the event loop
+struct MuHistograms {
+  TH1D *GM_run, *GM_event, *GM_luminosityBlock, *GM_multiplicity;
+  TH1D *GM_momentum, *GM_transverse_momentum, *GM_eta, *GM_phi, *GM_chi2;
+  TH1D *GM_mass_extended, *GM_mass, *GM_mass_log;
+  TH1D *GM_validhits, *GM_pixelhits;
+};
+
+// The histograms in the order in which they are written to the output file
+TH1D* MuHistograms::* const kMuHistograms[] = {
+  &MuHistograms::GM_run, &MuHistograms::GM_event, &MuHistograms::GM_luminosityBlock,
+  &MuHistograms::GM_multiplicity, &MuHistograms::GM_momentum,
+  &MuHistograms::GM_transverse_momentum, &MuHistograms::GM_eta, &MuHistograms::GM_phi,
+  &MuHistograms::GM_chi2, &MuHistograms::GM_mass_extended, &MuHistograms::GM_mass,
+  &MuHistograms::GM_mass_log, &MuHistograms::GM_validhits, &MuHistograms::GM_pixelhits
+};
 
-void MuHistos_publicchain() {
-  
-  TH1::SetDefaultSumw2(true);
+////////////////////////////////////////////////////////////////////////////////
+///////////////////////// Declare your histogram start /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
 
-  gROOT->Reset();
-  gStyle->SetOptStat("nemruo");
+void BookHistograms(MuHistograms &h) {
 
-  // Chain your tree
-  TChain *t1 = new TChain("Events");
-  
-  string inDir = "root://eospublic.cern.ch//eos/opendata/cms/derived-data/NanoAODRun1/01-Jul-22/";
+  // run nr, event nr, and lumi section for all events that have been analyzed
+  h.GM_run = new TH1D("Run number", "Run number", 3100, 146400, 149500);
+  h.GM_event = new TH1D("Event number", "Event number", 2000, 0, 2000000000);
+  h.GM_luminosityBlock = new TH1D("Lumi section", "Lumi section", 300, 0, 3000);
 
-  // Muon 2010 ntuples
-  //string infile = "Run2010B_Mu_merged.root";      // version NanoAODRun1_v1
-  string infile = "Run2010B_Mu/*.root";      // version NanoAODRun1_v1, chained
+  // global muon multiplicity
+  h.GM_multiplicity = new TH1D("GMmultiplicty", "GMmultiplicty", 8, 0, 8);
+  h.GM_multiplicity->GetXaxis()->SetTitle("Number of Global Muons");
+  h.GM_multiplicity->GetYaxis()->SetTitle("Number of Events");
 
-  t1->Add((inDir + infile).c_str());
+  // global muon momentum
+  h.GM_momentum = new TH1D("GMmomentum", "GMmomentum", 240, 0., 120.);
+  h.GM_momentum->GetXaxis()->SetTitle("Momentum of global muons (in GeV/c)");
+  h.GM_momentum->GetYaxis()->SetTitle("Number of Events");
 
-  // MuMonitor validation example with Muon 2010 dataset
-  string outfile = "MuHistos_Mu_publicchain.root";              // version NanoAODRun1_v1
+  // global muon transverse momentum
+  h.GM_transverse_momentum = new TH1D("GM_Transverse_momentum", "GM_Transverse_momentum", 240, 0., 120.);
+  h.GM_transverse_momentum->GetXaxis()->SetTitle("Transverse Momentum of global muons (in GeV/c)");
+  h.GM_transverse_momentum->GetYaxis()->SetTitle("Number of Events");
 
-  TFile fout((outfile).c_str(),"RECREATE");
+  // global muon pseudorapity
+  h.GM_eta = new TH1D("GM_eta", "GM_eta", 140, -3.5, 3.5);
+  h.GM_eta->GetXaxis()->SetTitle("Eta of global muons (in radians)");
+  h.GM_eta->GetYaxis()->SetTitle("Number of Events");
 
-  cout << "reading " << inDir << infile << endl;
-  cout << "writing to " << outfile << endl;
+  // global muon azimuth angle
+  h.GM_phi = new TH1D("GM_phi", "GM_phi", 314, -3.15, 3.15);
+  h.GM_phi->GetXaxis()->SetTitle("Phi of global muons (in radians)");
+  h.GM_phi->GetYaxis()->SetTitle("Number of Events");
+
+  // global muon normalized chi2
+  h.GM_chi2 = new TH1D("GM_normalizedchi2", "GM_normalizedchi2", 200, 0., 20.);
+  h.GM_chi2->GetXaxis()->SetTitle("chi2 / ndof of global muons");
+  h.GM_chi2->GetYaxis()->SetTitle("Number of Events");
+
+  // dimuon mass spectrum up to 120 GeV (high mass range: upsilon, Z)
+  h.GM_mass_extended = new TH1D("GMmass_extended", "GMmass_extended", 240, 0., 120.);
+  h.GM_mass_extended->GetXaxis()->SetTitle("Invariant Mass for Nmuon>=2 (in GeV/c^2)");
+  h.GM_mass_extended->GetYaxis()->SetTitle("Number of Events");
+
+  // dimuon mass spectrum up to 4 GeV (low mass range, rho/omega, phi, psi)
+  h.GM_mass = new TH1D("GMmass", "GMmass", 400, 0., 4.);
+  h.GM_mass->GetXaxis()->SetTitle("Invariant Mass for Nmuon>=2 (in GeV/c^2)");
+  h.GM_mass->GetYaxis()->SetTitle("Number of Events");
+
+  // logarithmic dimuon mass spectrum,
+  // binning chosen to correspond to log(0.3) - log(500), 200 bins/log10 unit
+  h.GM_mass_log = new TH1D("GM_mass_log", "GM_mass_log", 644, -0.52, 2.7);
+  h.GM_mass_log->GetXaxis()->SetTitle("Invariant Log10(Mass) for Nmuon>=2 (in log10(m/GeV/c^2))");
+  h.GM_mass_log->GetYaxis()->SetTitle("Number of Events/GeV");
+
+  // global muon track, number of valid hits
+  h.GM_validhits = new TH1D("GM_validhits", "GM_validhits", 100, 0., 100);
+  h.GM_validhits->GetXaxis()->SetTitle("Number of valid hits");
+  h.GM_validhits->GetYaxis()->SetTitle("Number of Events");
+
+  // global muon track, number of pixel hits
+  h.GM_pixelhits = new TH1D("GM_pixelhits", "GM_pixelhits", 14, 0., 14);
+  h.GM_pixelhits->GetXaxis()->SetTitle("Number of pixel hits");
+  h.GM_pixelhits->GetYaxis()->SetTitle("Number of Events");
+}
+
+// The event loop fills the histograms through HistogramBanks (see
+// common/HistogramBank.h), one fused fill per event, per global muon and per
+// dimuon pair, and copies them to the booked histograms at write time. The
+// binning has to be the same as in BookHistograms. The statistics of the
+// banks, and the weights of the log-mass histogram, the only weighted one, are
+// summed exactly (see common/ExactSum.h), so that all histograms, with their
+// entries, mean and RMS, are bitwise the same for every run and number of
+// threads, also 1. They are rounded once from the exact sums, so they can
+// differ in the last bits from histograms filled with TH1::Fill.
+
+// run, event, lumi section, global muon multiplicity
+constexpr std::array<FixedAxis, 4> kEventAxes = {{
+  {3100, 146400, 149500}, {2000, 0, 2000000000}, {300, 0, 3000}, {8, 0, 8}
+}};
+// momentum, transverse momentum, eta, phi, chi2, valid hits, pixel hits
+constexpr std::array<FixedAxis, 7> kMuonAxes = {{
+  {240, 0., 120.}, {240, 0., 120.}, {140, -3.5, 3.5}, {314, -3.15, 3.15}, {200, 0., 20.}, {100, 0., 100},
+  {14, 0., 14}
+}};
+// mass up to 120 GeV, mass up to 4 GeV
+constexpr std::array<FixedAxis, 2> kMassAxes = {{
+  {240, 0., 120.}, {400, 0., 4.}
+}};
+// log10 mass, binned from the mass with a table of the bin edges in mass
+const auto kMassLogAxis = std::make_shared<const LogMassAxis<Float_t>>(644, -0.52, 2.7);
+
+struct MuHistogramBank {
+  ExactHistogramBank<kEventAxes> event;
+  ExactHistogramBank<kMuonAxes> muon;
+  ExactHistogramBank<kMassAxes> mass;
+  LogMassHistogram<Float_t, ExactSum> massLog{kMassLogAxis, 200 / log(10)};
+
+  void Add(const MuHistogramBank &other) {
+    event.Add(other.event);
+    muon.Add(other.muon);
+    mass.Add(other.mass);
+    massLog.Add(other.massLog);
+  }
+
+  // Set the booked histograms to the contents of the bank
+  void CopyTo(MuHistograms &h) const {
+    event.CopyTo(0, *h.GM_run);
+    event.CopyTo(1, *h.GM_event);
+    event.CopyTo(2, *h.GM_luminosityBlock);
+    event.CopyTo(3, *h.GM_multiplicity);
+    muon.CopyTo(0, *h.GM_momentum);
+    muon.CopyTo(1, *h.GM_transverse_momentum);
+    muon.CopyTo(2, *h.GM_eta);
+    muon.CopyTo(3, *h.GM_phi);
+    muon.CopyTo(4, *h.GM_chi2);
+    muon.CopyTo(5, *h.GM_validhits);
+    muon.CopyTo(6, *h.GM_pixelhits);
+    mass.CopyTo(0, *h.GM_mass_extended);
+    mass.CopyTo(1, *h.GM_mass);
+    massLog.CopyTo(*h.GM_mass_log);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////// Declare your histogram end //////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+// Loop over the entries [first, last) of the input and fill the histograms h.
+// Every call uses its own chain, so that several calls can run in parallel.
+// The dimuon masses are also added to slot of candidates, the read and
+// decompression times to throughput, the processed entries to progress and
+// the bank to snapshots for the partial histograms (see common/Progress.h),
+// if given.
+void ProcessEntries(const string &input, Long64_t first, Long64_t last, MuHistogramBank &h,
+                    MassCandidateWriter *candidates = nullptr, unsigned int slot = 0,
+                    Throughput *throughput = nullptr, Progress *progress = nullptr,
+                    SnapshotBuffers<MuHistogramBank> *snapshots = nullptr) {
+
+  // Chain your tree
+  TChain *t1 = new TChain("Events");
+  t1->Add(input.c_str());
 
 ////////////////////////////////////////////////////////////////////////////////
 ///////////////////////// Declare input variables start ////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
-  
+
   // Variables in the tree
   UInt_t run;
   ULong64_t event;  // use this for newer versions starting from .zerobias
   UInt_t luminosityBlock;
-  UInt_t nMuon;
-  // should replace 128 by parameter; check whether value is appropriate!
-  Float_t Muon_mass[128];
-  Float_t Muon_pt[128];
-  Float_t Muon_gpt[128];
-  Float_t Muon_eta[128];
-  Float_t Muon_geta[128];
-  Float_t Muon_phi[128];
-  Float_t Muon_gphi[128]; 
-  Float_t Muon_gChi2[128];
-  Int_t Muon_charge[128];
-  Bool_t Muon_isTracker[128];
-  Bool_t Muon_isGlobal[128];
-  Int_t Muon_nValid[128];
-  Int_t Muon_gnValid[128];  
-  Int_t Muon_gnValidMu[128];  // was nValidMu; documentation says "bug", check!
-  Int_t Muon_nPix[128];
-  Int_t Muon_gnPix[128];
+  MuonCollection mu;  // nMuon and the Muon_* arrays, sized to the largest event
 
   // Variables defined in this code
   UInt_t nGlobal;
-  TLorentzVector p4mu1, p4mu2, p4dimu;
-  TLorentzVector p4gmu1, p4gmu2, p4gdimu;
-  Float_t Muon_p1, Muon_p2, Muon_gp1, Muon_gp2; 
+  UInt_t nMuon;  // muons of the event whose columns have been read
+  DimuonMassKernel kernel;  // muon four-vectors and dimuon masses
+  std::vector<unsigned int> plus, minus;  // indices of the good global muons by charge
+  std::vector<unsigned int> pair1, pair2;  // muon indices of the opposite-sign pairs
+  std::vector<Float_t> pairMass;
+  Float_t Muon_gp1;
   Float_t s, w;
-  
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////// Declare input variables end ////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -98,231 +252,275 @@ void MuHistos_publicchain() {
   t1->SetBranchStatus("run", 1);
   t1->SetBranchStatus("event", 1);
   t1->SetBranchStatus("luminosityBlock", 1);
-  t1->SetBranchStatus("nMuon", 1);
-  t1->SetBranchStatus("Muon_mass", 1);
-  t1->SetBranchStatus("Muon_pt", 1);
-  t1->SetBranchStatus("Muon_gpt", 1);
-  t1->SetBranchStatus("Muon_eta", 1);
-  t1->SetBranchStatus("Muon_geta", 1);
-  t1->SetBranchStatus("Muon_phi", 1);
-  t1->SetBranchStatus("Muon_gphi", 1);
-  t1->SetBranchStatus("Muon_gChi2", 1);
-  t1->SetBranchStatus("Muon_charge", 1);
-  t1->SetBranchStatus("Muon_isTracker", 1);
-  t1->SetBranchStatus("Muon_isGlobal", 1);
-  t1->SetBranchStatus("Muon_nValid", 1);
-  t1->SetBranchStatus("Muon_gnValid", 1);
-  t1->SetBranchStatus("Muon_gnValidMu", 1);
-  t1->SetBranchStatus("Muon_nPix", 1);
-  t1->SetBranchStatus("Muon_gnPix", 1);
-
-////////////////////////////////////////////////////////////////////////////////
-///////////////////////////// Activate branches end ////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-
-////////////////////////////////////////////////////////////////////////////////
-////////////////////// Get the address of the branch start /////////////////////
-////////////////////////////////////////////////////////////////////////////////
 
   t1->SetBranchAddress("run", &run);
   t1->SetBranchAddress("event", &event);
   t1->SetBranchAddress("luminosityBlock", &luminosityBlock);
-  t1->SetBranchAddress("nMuon", &nMuon);
-  t1->SetBranchAddress("Muon_mass", Muon_mass);
-  t1->SetBranchAddress("Muon_pt", Muon_pt);
-  t1->SetBranchAddress("Muon_gpt", Muon_gpt);
-  t1->SetBranchAddress("Muon_eta", Muon_eta);
-  t1->SetBranchAddress("Muon_geta", Muon_geta);
-  t1->SetBranchAddress("Muon_phi", Muon_phi);
-  t1->SetBranchAddress("Muon_gphi", Muon_gphi);
-  t1->SetBranchAddress("Muon_gChi2", Muon_gChi2);
-  t1->SetBranchAddress("Muon_charge", Muon_charge);
-  t1->SetBranchAddress("Muon_isTracker", Muon_isTracker);  
-  t1->SetBranchAddress("Muon_isGlobal", Muon_isGlobal);
-  t1->SetBranchAddress("Muon_nValid", Muon_nValid);
-  t1->SetBranchAddress("Muon_gnValid", Muon_gnValid);
-  t1->SetBranchAddress("Muon_gnValidMu", Muon_gnValidMu); 
-  t1->SetBranchAddress("Muon_nPix", Muon_nPix);
-  t1->SetBranchAddress("Muon_gnPix", Muon_gnPix); 
 
-////////////////////////////////////////////////////////////////////////////////
-/////////////////////// Get the address of the branch end //////////////////////
-////////////////////////////////////////////////////////////////////////////////
+  // nMuon and all Muon_* branches
+  mu.Bind(t1);
 
-////////////////////////////////////////////////////////////////////////////////
-///////////////////////// Declare your histogram start /////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-  
-  // run nr, event nr, and lumi section for all events that have been analyzed
-  TH1D *GM_run = new TH1D("Run number", "Run number", 3100, 146400, 149500);
-  TH1D *GM_event = new TH1D("Event number", "Event number", 2000, 0, 2000000000);
-  TH1D *GM_luminosityBlock = new TH1D("Lumi section", "Lumi section", 300, 0, 3000);
-  
-  // global muon multiplicity
-  TH1D *GM_multiplicity = new TH1D("GMmultiplicty", "GMmultiplicty", 8, 0, 8);
-  GM_multiplicity->GetXaxis()->SetTitle("Number of Global Muons");
-  GM_multiplicity->GetYaxis()->SetTitle("Number of Events");
+  // read-ahead cache for the enabled branches of this range (see common/TreeIO.h)
+  TreeIO::Configure(t1, first, last);
+  if (slot == 0 && first == 0) TreeIO::Print(t1);
 
-  // global muon momentum
-  TH1D *GM_momentum = new TH1D("GMmomentum", "GMmomentum", 240, 0., 120.);
-  GM_momentum->GetXaxis()->SetTitle("Momentum of global muons (in GeV/c)");
-  GM_momentum->GetYaxis()->SetTitle("Number of Events");
+  // time spent reading and decompressing the baskets of this loop
+  TTreePerfStats *ioStats = throughput ? new TTreePerfStats("ioperf", t1) : nullptr;
 
-  // global muon transverse momentum
-  TH1D *GM_transverse_momentum = new TH1D("GM_Transverse_momentum", "GM_Transverse_momentum", 240, 0., 120.);
-  GM_transverse_momentum->GetXaxis()->SetTitle("Transverse Momentum of global muons (in GeV/c)");
-  GM_transverse_momentum->GetYaxis()->SetTitle("Number of Events");
-
-  // global muon pseudorapity
-  TH1D *GM_eta = new TH1D("GM_eta", "GM_eta", 140, -3.5, 3.5);
-  GM_eta->GetXaxis()->SetTitle("Eta of global muons (in radians)");
-  GM_eta->GetYaxis()->SetTitle("Number of Events");
-
-  // global muon azimuth angle
-  TH1D *GM_phi = new TH1D("GM_phi", "GM_phi", 314, -3.15, 3.15);
-  GM_phi->GetXaxis()->SetTitle("Phi of global muons (in radians)");
-  GM_phi->GetYaxis()->SetTitle("Number of Events");
-
-  // global muon normalized chi2
-  TH1D *GM_chi2 = new TH1D("GM_normalizedchi2", "GM_normalizedchi2", 200, 0., 20.);
-  GM_chi2->GetXaxis()->SetTitle("chi2 / ndof of global muons");
-  GM_chi2->GetYaxis()->SetTitle("Number of Events");
+  // entries between updates of the progress and offers of the bank
+  const Long64_t progressEntries = 10000;
 
-  // dimuon mass spectrum up to 120 GeV (high mass range: upsilon, Z)
-  TH1D *GM_mass_extended = new TH1D("GMmass_extended", "GMmass_extended", 240, 0., 120.);
-  GM_mass_extended->GetXaxis()->SetTitle("Invariant Mass for Nmuon>=2 (in GeV/c^2)");
-  GM_mass_extended->GetYaxis()->SetTitle("Number of Events");
-  
-  // dimuon mass spectrum up to 4 GeV (low mass range, rho/omega, phi, psi)
-  TH1D *GM_mass = new TH1D("GMmass", "GMmass", 400, 0., 4.);
-  GM_mass->GetXaxis()->SetTitle("Invariant Mass for Nmuon>=2 (in GeV/c^2)");
-  GM_mass->GetYaxis()->SetTitle("Number of Events");
-
-  // logarithmic dimuon mass spectrum, 
-  // binning chosen to correspond to log(0.3) - log(500), 200 bins/log10 unit
-  TH1D *GM_mass_log = new TH1D("GM_mass_log", "GM_mass_log", 644, -0.52, 2.7);
-  GM_mass_log->GetXaxis()->SetTitle("Invariant Log10(Mass) for Nmuon>=2 (in log10(m/GeV/c^2))");
-  GM_mass_log->GetYaxis()->SetTitle("Number of Events/GeV");
-
-  // global muon track, number of valid hits
-  TH1D *GM_validhits = new TH1D("GM_validhits", "GM_validhits", 100, 0., 100);
-  GM_validhits->GetXaxis()->SetTitle("Number of valid hits");
-  GM_validhits->GetYaxis()->SetTitle("Number of Events");
-
-  // global muon track, number of pixel hits
-  TH1D *GM_pixelhits = new TH1D("GM_pixelhits", "GM_pixelhits", 14, 0., 14);
-  GM_pixelhits->GetXaxis()->SetTitle("Number of pixel hits");
-  GM_pixelhits->GetYaxis()->SetTitle("Number of Events");
-  
 ////////////////////////////////////////////////////////////////////////////////
-////////////////////////// Declare your histogram end //////////////////////////
+///////////////////////////// Activate branches end ////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
-  
-  Int_t nevent = t1->GetEntries();
-  cout << "entries = " << nevent << endl;
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////// Start analyze! //////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
-  
-  // Loop over all events
-  for (int aa = 0; aa < nevent; aa++) {
- 
-    if (aa % 1000000 == 0) cout << "event nr " << aa << endl;
-
-    // Get the entry of your event
-    t1->GetEntry(aa);
 
-    // fill histograms
-    GM_run->Fill(run);
-    GM_event->Fill(event);
-    GM_luminosityBlock->Fill(luminosityBlock);
+  // Loop over all events of this range
+  for (Long64_t aa = first; aa < last; aa++) {
+
+    if (aa > first && (aa - first) % progressEntries == 0) {
+      if (progress) progress->Add(slot, progressEntries);
+      if (snapshots) snapshots->Offer(slot, h);
+    }
+
+    // Get the entry of your event in two phases: run, event, lumi section and
+    // nMuon first, then Muon_isGlobal if there are muons, and the other muon
+    // columns only if one of them is a global muon. The baskets of the muon
+    // columns are not decompressed for runs of events without global muons.
+    mu.GetScalars(aa);
+    nMuon = 0;
+    if (mu.nMuon > 0) {
+      mu.GetColumn(mu.isGlobal);
+      if (std::any_of(mu.isGlobal, mu.isGlobal + mu.nMuon, [](Bool_t global) { return global; })) {
+        mu.GetMuons();
+        nMuon = mu.nMuon;
+      }
+    }
 
     nGlobal = 0;  // global muon counter
+    plus.clear();
+    minus.clear();
+    pair1.clear();
+    pair2.clear();
 
-    // Loop over nMuon for single muon variables and dimuon mass plot
+    // four-vectors of all muons of the event
+    kernel.SetMuons(nMuon, mu.gpt, mu.geta, mu.gphi, mu.mass);
+
+    // Loop over nMuon for single muon variables, and collect the global muons
+    // passing the quality cuts by charge
     for (unsigned int bb = 0; bb < nMuon; bb++) {
 
-      if (!Muon_isGlobal[bb]) continue;
-      
+      if (!mu.isGlobal[bb]) continue;
+
       nGlobal++;
 
-      p4gmu1.SetPtEtaPhiM(Muon_gpt[bb], Muon_geta[bb], Muon_gphi[bb], Muon_mass[bb]);
-      Muon_gp1 = p4gmu1.P();
-      
-      // Fill the histogram
-      GM_momentum->Fill(Muon_gp1);
-      GM_transverse_momentum->Fill(Muon_gpt[bb]);
-      GM_eta->Fill(Muon_geta[bb]);
-      GM_phi->Fill(Muon_gphi[bb]);
-      GM_chi2->Fill(Muon_gChi2[bb]);
-      GM_validhits->Fill(Muon_gnValid[bb] + Muon_gnValidMu[bb]);
-      GM_pixelhits->Fill(Muon_gnPix[bb]);
+      Muon_gp1 = kernel.P(bb);
+
+      // Fill the histograms
+      h.muon.Fill({Muon_gp1, mu.gpt[bb], mu.geta[bb], mu.gphi[bb], mu.gChi2[bb],
+                   double(mu.gnValid[bb] + mu.gnValidMu[bb]), double(mu.gnPix[bb])});
 
       if (nMuon < 2) continue;
 
       // quality cuts
-      if (Muon_gnValid[bb] + Muon_gnValidMu[bb] < 12 
-        || Muon_gnPix[bb] < 2
-        || Muon_gChi2[bb] >= 4.0) continue;
+      if (mu.gnValid[bb] + mu.gnValidMu[bb] < 12
+        || mu.gnPix[bb] < 2
+        || mu.gChi2[bb] >= 4.0) continue;
+
+      (mu.charge[bb] > 0 ? plus : minus).push_back(bb);
 
-      // loop over second muon to calculate dimuon invariant mass
-      for (unsigned int cc = bb + 1 ; cc < nMuon; cc++) {
+    } // end of loop over muons
 
-        if (!Muon_isGlobal[cc]) continue;
-        if (Muon_charge[bb] + Muon_charge[cc] != 0) continue;
+    // Opposite-sign pairs of these muons, in the order of a loop over the first
+    // and then the second muon of the pair: the next first muon is the lower of
+    // the next positive and negative muon, and it is paired with all following
+    // muons of the other charge (NanoAOD muons have charge +1 or -1)
+    for (size_t ip = 0, im = 0; ip < plus.size() && im < minus.size();) {
+      if (plus[ip] < minus[im]) {
+        for (size_t k = im; k < minus.size(); k++) {
+          pair1.push_back(plus[ip]);
+          pair2.push_back(minus[k]);
+        }
+        ip++;
+      } else {
+        for (size_t k = ip; k < plus.size(); k++) {
+          pair1.push_back(minus[im]);
+          pair2.push_back(plus[k]);
+        }
+        im++;
+      }
+    }
 
-        // quality cuts
-        if (Muon_gnValid[cc] + Muon_gnValidMu[cc] < 12 
-          || Muon_gnPix[cc] < 2
-          || Muon_gChi2[cc] >= 4.0) continue;
+    // calculate the dimuon invariant masses of all pairs in one batch
+    pairMass.resize(pair1.size());
+    kernel.Masses(pair1.size(), pair1.data(), pair2.data(), pairMass.data());
 
-        p4gmu2.SetPtEtaPhiM(Muon_gpt[cc], Muon_geta[cc], Muon_gphi[cc], Muon_mass[cc]);
-        Muon_gp2 = p4gmu2.P();
+    for (size_t pp = 0; pp < pairMass.size(); pp++) {
 
-        // calculate dimuon invariant mass
-        p4gdimu = p4gmu1 + p4gmu2;
-        s = p4gdimu.M();
-        w = 200 / log(10) / s;
+      s = pairMass[pp];
+      w = 200 / log(10) / s;
 
-        GM_mass_extended->Fill(s);
-        GM_mass->Fill(s);
-        GM_mass_log->Fill(log10(s), w);
+      h.mass.Fill({s, s});
+      h.massLog.Fill(s, w);
 
-      } // end of loop over second muon
-    } // end of loop over first muon
+      if (candidates) candidates->Add(slot, s, 1, 1);
 
-    GM_multiplicity->Fill(nGlobal);
+    } // end of loop over dimuon pairs
+
+    // fill the event histograms
+    h.event.Fill({double(run), double(event), double(luminosityBlock), double(nGlobal)});
 
   } // end of loop over all events
 
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////// End analyze! ///////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
-  
+
+  if (progress && last > first) progress->Add(slot, (last - first - 1) % progressEntries + 1);
+
+  if (ioStats) {
+    throughput->AddIOStats(*ioStats);
+    delete ioStats;
+  }
+  delete t1;
+}
+
+void MuHistos_publicchain() {
+
+  TH1::SetDefaultSumw2(true);
+
+  gROOT->Reset();
+  gStyle->SetOptStat("nemruo");
+
+  // Chain your tree
+  TChain *t1 = new TChain("Events");
+
+  // eospublic, or the local directory NANOAODRUN1_INDIR (see common/NanoAODRun1Input.h)
+  string inDir = NanoAODRun1Input::Dir();
+  const int nThreads = std::max(1u, NanoAODRun1Input::Threads(defaultThreads));
+
+  // Muon 2010 ntuples
+  //string infile = "Run2010B_Mu_merged.root";      // version NanoAODRun1_v1
+  string infile = "Run2010B_Mu/*.root";      // version NanoAODRun1_v1, chained
+
+  t1->Add((inDir + infile).c_str());
+  // read-ahead modes of all files, set here before the worker threads start
+  TreeIO::SetGlobalOptions(t1);
+
+  // MuMonitor validation example with Muon 2010 dataset
+  string outfile = "MuHistos_Mu_publicchain.root";              // version NanoAODRun1_v1
+
+  TFile fout((outfile).c_str(),"RECREATE");
+
+  // event rate, bytes read and stage times, written to <outfile>_throughput.json
+  Throughput throughput(outfile.substr(0, outfile.size() - 5), nThreads);
+
+  cout << "reading " << inDir << infile << endl;
+  cout << "writing to " << outfile << endl;
+
+  // Book the histograms in the output file
+  MuHistograms h;
+  BookHistograms(h);
+
+  auto stageOpen = throughput.Stage("open input");
+  Long64_t nevent = t1->GetEntries();
+  cout << "entries = " << nevent << endl;
+  stageOpen.Stop();
+  throughput.SetEvents(nevent);
+
+  // Optional file with the masses of all dimuon pairs
+  MassCandidateWriter *candidates = nullptr;
+  if (writeMassCandidates) {
+    string candidatefile = outfile.substr(0, outfile.size() - 5) + "_masses.bin";
+    cout << "writing dimuon masses to " << candidatefile << endl;
+    candidates = new MassCandidateWriter(candidatefile, nThreads, {"opposite sign global muon pairs"});
+  }
+
+  // histogram banks of the threads, added to the first one after the loop
+  std::vector<std::unique_ptr<MuHistogramBank>> banks;
+  for (int i = 0; i < nThreads; i++) banks.push_back(std::make_unique<MuHistogramBank>());
+
+  // processed entries, rate and ETA every NANOAODRUN1_PROGRESS seconds, and with
+  // NANOAODRUN1_SNAPSHOT=1 the histograms filled so far in <outfile>_snapshot.root
+  // (see common/Progress.h)
+  Progress progress(outfile.substr(0, outfile.size() - 5), nevent, nThreads);
+  SnapshotBuffers<MuHistogramBank> snapshots(nThreads);
+  progress.SetSnapshot(snapshots, [](const std::vector<const MuHistogramBank *> &partial, TDirectory &dir) {
+    auto sum = std::make_unique<MuHistogramBank>();
+    for (const auto *bank : partial) sum->Add(*bank);
+    MuHistograms hs;
+    BookHistograms(hs);
+    sum->CopyTo(hs);
+    for (auto member : kMuHistograms) (hs.*member)->SetDirectory(&dir);
+  });
+
+  if (nThreads <= 1) {
+
+    // Serial event loop
+    auto stageLoop = throughput.Stage("event loop");
+    progress.Start();
+    ProcessEntries(inDir + infile, 0, nevent, *banks[0], candidates, 0, &throughput, &progress, &snapshots);
+    progress.Stop();
+
+  } else {
+
+    // Parallel event loop: the files are split into ranges of entries, which
+    // the threads take from their own queue and, once that is empty, from the
+    // busiest other thread, so that large files do not leave the other threads
+    // idle at the end. Every thread fills its own histogram bank, and the
+    // banks are added in thread order afterwards.
+    ROOT::EnableThreadSafety();
+    ChainScheduler scheduler(*t1, nThreads);
+    cout << "using " << nThreads << " threads, tasks of " << scheduler.TaskEntries() << " entries" << endl;
+
+    // time of every task, to find slow files
+    TaskLog tasks(nThreads);
+    auto stageLoop = throughput.Stage("event loop");
+    progress.Start();
+    scheduler.Run([&](unsigned int worker, const ChainTask &task) {
+      ProcessEntries(task.file, task.first, task.last, *banks[worker], candidates, worker, &throughput, &progress,
+                     &snapshots);
+    }, &tasks);
+    progress.Stop();
+    stageLoop.Stop();
+    cout << scheduler.Steals() << " ranges taken over by idle threads" << endl;
+    tasks.Print();
+    tasks.Write(outfile.substr(0, outfile.size() - 5) + "_tasks.csv");
+
+    auto stageMerge = throughput.Stage("merge histograms");
+    for (int i = 1; i < nThreads; i++) banks[0]->Add(*banks[i]);
+  }
+
 ////////////////////////////////////////////////////////////////////////////////
 //////////////////////// write histograms and close file ///////////////////////
 ////////////////////////////////////////////////////////////////////////////////
-  
+
   // Write out the histograms
-  GM_run->Write();
-  GM_event->Write();
-  GM_luminosityBlock->Write();
-  GM_multiplicity->Write(); 
-  GM_momentum->Write();
-  GM_transverse_momentum->Write();
-  GM_eta->Write();
-  GM_phi->Write(); 
-  GM_chi2->Write(); 
-  GM_mass_extended->Write();
-  GM_mass->Write();
-  GM_mass_log->Write();
-  GM_validhits->Write();
-  GM_pixelhits->Write();
- 
+  auto stageWrite = throughput.Stage("write histograms");
+  banks[0]->CopyTo(h);
+  fout.cd();
+  for (auto member : kMuHistograms) (h.*member)->Write();
+
   fout.Close();
 
+  if (candidates) {
+    candidates->Close();
+    cout << "wrote " << candidates->Size() << " dimuon masses" << endl;
+    delete candidates;
+  }
+  stageWrite.Stop();
+
+  throughput.Print();
+  throughput.Write();
+
   gROOT->ProcessLine(".q");
 
 } // end of script
 
+int main() {
+  MuHistos_publicchain();
+  return 0;
+}
@@ -0,0 +1,143 @@
+// Compiled version of Dimuon2011_eospublic.C, producing the same histograms,
+// plot and output file (named Dimuon2011_eospublic_compiled.*).
+//
+// Every selection string of the t->Draw("log10(Dimu_mass)>>h", ...) calls of
+// the macro is a typed C++ function of the trigger bits (see TriggerMask2011.h)
+// and of the dimuon candidate here, so nothing is parsed or compiled at run
+// time, and the six MuOnia histograms are filled in a single TTreeReader loop
+// over the chain (see DimuonLogMass2011.h).
+//
+// Usage: root -l -b -q Dimuon2011_eospublic_compiled.cxx++
+//    or: the Dimuon2011_eospublic_compiled executable of the CMake build,
+//        run from this directory
+
+#include <iostream>
+#include "TCanvas.h"
+#include "TChain.h"
+#include "TFile.h"
+#include "TH1D.h"
+#include "TROOT.h"
+#include "TStyle.h"
+#include "TTreePerfStats.h"
+#include "DimuonLogMass2011.h"
+#include "../common/NanoAODRun1Input.h"
+#include "../common/Throughput.h"
+#include "../common/TreeIO.h"
+
+using namespace DimuonLogMass2011;
+
+void Dimuon2011_eospublic_compiled()
+{
+  // event rate, bytes read and time of every pass, written to Dimuon2011_eospublic_compiled_throughput.json
+  Throughput throughput("Dimuon2011_eospublic_compiled", 1);
+
+  // chain t1 is 2011 DoubleMu Run A in NanoAODRun1 format
+  TChain *t1 = new TChain("Events");
+  t1->Add(NanoAODRun1Input::Path("Run2011A_DoubleMu_merged.root").c_str());
+  // read-ahead modes of both chains, which read from the same place
+  TreeIO::SetGlobalOptions(t1);
+  TTreePerfStats ioperf1("ioperf_DoubleMu", t1);
+
+  // define a canvas with log y scale
+  TCanvas *c1 = new TCanvas("c1", "c1", 1);
+  c1->SetLogy();          // set log scale
+  gStyle->SetOptStat(0);  // remove box
+
+  // book the histogram
+  TH1D *h_dimulog = new TH1D("h_dimulog", "h_dimulog", 620, -0.4, 2.7);
+  gROOT->cd();
+  std::cout << "high pt dimuon" << std::endl;
+  // fill the histogram ("high pt" = 13/8 or larger, see threshold "bump")
+  {
+    auto stage = throughput.Stage("high pt dimuon");
+    FillLogMass(*t1,
+                {{h_dimulog,
+                  [](ULong64_t mask, const DimuonCandidate &dimu) {
+                    return (mask & kDoubleMuThreshold) != 0 && PtAbove(dimu, 6.);
+                  }}},
+                false);
+  }
+  TreeIO::Print(t1);
+  throughput.AddIOStats(ioperf1);
+  // clone the histogram and set to no directory such that it does not get deleted
+  TH1D *h_dimulog1 = (TH1D *)h_dimulog->Clone();
+  h_dimulog1->SetDirectory(0);
+
+  // chain t2 is 2011 MuOnia Run A in NanoAODRun1 format
+  TChain *t2 = new TChain("Events");
+  t2->Add(NanoAODRun1Input::Path("Run2011A_MuOnia_merged.root").c_str());
+  TTreePerfStats ioperf2("ioperf_MuOnia", t2);
+
+  TH1D *h_dimulog2 = new TH1D("h_dimulog2", "h_dimulog2", 620, -0.4, 2.7);
+  TH1D *h_dimulog4 = new TH1D("h_dimulog4", "h_dimulog4", 620, -0.4, 2.7);
+  TH1D *h_dimulog6 = new TH1D("h_dimulog6", "h_dimulog6", 620, -0.4, 2.7);
+  TH1D *h_dimulog7 = new TH1D("h_dimulog7", "h_dimulog7", 620, -0.4, 2.7);
+  TH1D *h_dimulog8 = new TH1D("h_dimulog8", "h_dimulog8", 620, -0.4, 2.7);
+  TH1D *h_dimulog12 = new TH1D("h_dimulog12", "h_dimulog12", 620, -0.4, 2.7);
+  TH1D *h_dimulog3 = (TH1D *)h_dimulog2->Clone();
+  TH1D *h_dimulog5 = (TH1D *)h_dimulog4->Clone();
+  TH1D *h_dimulog9 = (TH1D *)h_dimulog4->Clone();
+  TH1D *h_dimulog10 = (TH1D *)h_dimulog4->Clone();
+  TH1D *h_dimulog11 = (TH1D *)h_dimulog4->Clone();
+  TH1D *h_dimulog13 = (TH1D *)h_dimulog4->Clone();
+
+  // all six selections in one pass over the chain (see DimuonLogMass2011.h)
+  for (const auto &selection : kMuOniaSelections) std::cout << selection.title << std::endl;
+  {
+    auto stage = throughput.Stage("MuOnia selections");
+    FillMuOnia(*t2, {h_dimulog4, h_dimulog2, h_dimulog6, h_dimulog7, h_dimulog8, h_dimulog12});
+  }
+  TreeIO::Print(t2);
+
+  auto stage = throughput.Stage("plot and output");
+  h_dimulog3->Add(h_dimulog1, h_dimulog2, 1, 1);
+  h_dimulog5->Add(h_dimulog1, h_dimulog4, 1, 1);
+  h_dimulog9->Add(h_dimulog1, h_dimulog6, 1, 1);
+  h_dimulog10->Add(h_dimulog1, h_dimulog7, 1, 1);
+  h_dimulog11->Add(h_dimulog1, h_dimulog8, 1, 1);
+  h_dimulog13->Add(h_dimulog1, h_dimulog12, 1, 1);
+
+  // draw histogram
+  h_dimulog9->SetTitle("Dimuon mass spectrum 2011 7 TeV (1.2 fb-1)");  // set histogram title
+  h_dimulog9->SetFillColor(8);  // Green
+  h_dimulog9->GetXaxis()->SetTitle("Invariant Log10(Mass) for Nmuon>=2 (in log10(m/GeV/c^2))");
+  h_dimulog9->GetYaxis()->SetTitle("Number of Events/10 MeV");
+  h_dimulog9->SetMinimum(0.02);
+  h_dimulog9->SetMaximum(3.E6);
+  h_dimulog9->Draw("hist");
+  // draw others on top
+  h_dimulog10->SetFillColor(29);  // blue_green
+  h_dimulog10->Draw("hist same");
+  h_dimulog13->SetFillColor(9);  // dark blue
+  h_dimulog13->Draw("hist same");
+  h_dimulog11->SetFillColor(2);  // red
+  h_dimulog11->Draw("hist same");
+  h_dimulog3->SetFillColor(38);  // dark grey
+  h_dimulog3->Draw("hist same");
+  h_dimulog1->SetFillColor(18);  // light grey
+  h_dimulog1->Draw("hist same");
+  // regenerate ticks
+  gPad->RedrawAxis();
+
+  // produce output picture file
+  c1->Print("Dimuon2011_eospublic_compiled.png");
+  // write out histograms (will delete previous file, if any!)
+  TFile Dimuon2011("Dimuon2011_eospublic_compiled.root", "RECREATE");
+  for (TH1D *h : {h_dimulog1, h_dimulog2, h_dimulog3, h_dimulog4, h_dimulog5, h_dimulog6, h_dimulog7, h_dimulog8,
+                  h_dimulog9, h_dimulog10, h_dimulog11, h_dimulog12, h_dimulog13})
+    h->Write();
+  Dimuon2011.Close();
+  stage.Stop();
+
+  // both chains are read once
+  throughput.SetEvents(t1->GetEntries() + t2->GetEntries());
+  throughput.AddIOStats(ioperf2);
+  throughput.Print();
+  throughput.Write();
+}
+
+int main() {
+  gROOT->SetBatch(kTRUE);
+  Dimuon2011_eospublic_compiled();
+  return 0;
+}
@@ -0,0 +1,174 @@
+// Single-pass fill of the log10(Dimu_mass) histograms of the 2011 TTree examples.
+//
+// Every t->Draw("log10(Dimu_mass)>>h", "2./log(10.)/Dimu_mass*(selection)")
+// of Dimuon2011_eospublic.C is a typed C++ function of the trigger bits (see
+// TriggerMask2011.h) and of the dimuon candidate here. FillLogMass reads a
+// chain once and evaluates all its selections for every candidate, so the six
+// MuOnia histograms cost one pass over the chain instead of six.
+//
+// The histograms are filled with the same values, weights and order of
+// entries as by the Draw calls (TTreeFormula evaluates in double precision and
+// skips candidates of weight 0), so they are identical to those of the macro.
+//
+// Usage:
+//   FillLogMass(*chain, {{h_a, [](ULong64_t mask, const DimuonCandidate &dimu) { return ...; }},
+//                        {h_b, ...}});
+//   FillMuOnia(*t2, {h_dimulog4, h_dimulog2, h_dimulog6, h_dimulog7, h_dimulog8, h_dimulog12});
+
+#ifndef NANOAODRUN1_DIMUONLOGMASS2011_H
+#define NANOAODRUN1_DIMUONLOGMASS2011_H
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "TChain.h"
+#include "TH1D.h"
+#include "TTreeReader.h"
+#include "TTreeReaderArray.h"
+#include "TTreeReaderValue.h"
+#include "TriggerMask2011.h"
+#include "../common/TreeIO.h"
+
+namespace DimuonLogMass2011 {
+
+using namespace TriggerMask2011;
+
+// Dimuon candidate of an event, with the properties its selections use
+struct DimuonCandidate {
+  Float_t mass;
+  Float_t pt1, pt2;  // pt of the two muons
+};
+
+// A histogram and the selection of the candidates filled into it
+struct LogMassSelection {
+  TH1D *h;
+  bool (*pass)(ULong64_t mask, const DimuonCandidate &dimu);
+};
+
+// Fill log10(Dimu_mass) with weight 2/ln(10)/Dimu_mass into every histogram
+// whose selection pass(mask, candidate) is true, for all opposite-sign
+// candidates of two medium muons in events with run < 170000, in one pass
+// over the chain. The mask is read from the HLT_mask column of an "HLTmask"
+// friend of the chain if there is one that was made from the file of the chain
+// (see makeTriggerMask2011.C and HasMaskFriend), and is computed from the HLT
+// branches otherwise; only its DoubleMu threshold bit is
+// filled without HLT paths.
+inline void FillLogMass(TChain &chain, const std::vector<LogMassSelection> &selections, bool withHLTPaths = true)
+{
+  TTreeReader reader(&chain);
+  TTreeReaderValue<UInt_t> run(reader, "run");
+  TTreeReaderArray<Int_t> charge(reader, "Dimu_charge");
+  TTreeReaderArray<Float_t> mass(reader, "Dimu_mass");
+  TTreeReaderArray<Int_t> t1muIdx(reader, "Dimu_t1muIdx");
+  TTreeReaderArray<Int_t> t2muIdx(reader, "Dimu_t2muIdx");
+  TTreeReaderArray<Float_t> pt(reader, "Muon_pt");
+  TTreeReaderArray<Bool_t> mediumId(reader, "Muon_mediumId");
+  const bool friendMask = withHLTPaths && HasMaskFriend(chain);
+  std::unique_ptr<TTreeReaderValue<ULong64_t>> storedMask;
+  std::unique_ptr<Reader> trigger;
+  if (friendMask)
+    storedMask = std::make_unique<TTreeReaderValue<ULong64_t>>(reader, "HLT_mask");
+  else
+    trigger = std::make_unique<Reader>(reader, chain, withHLTPaths);
+
+  // read-ahead cache for the branches read here (TTreeReader leaves all
+  // branches enabled, so they are listed explicitly, see common/TreeIO.h)
+  std::vector<std::string> branches = {"run",          "nDimu", "Dimu_charge", "Dimu_mass",    "Dimu_t1muIdx",
+                                       "Dimu_t2muIdx", "nMuon", "Muon_pt",     "Muon_mediumId"};
+  if (!friendMask) {
+    branches.push_back("Trig_DoubleMuThresh");
+    if (withHLTPaths) {
+      branches.insert(branches.end(), {"Trig_JpsiThresh", "Alsoon_DoubleMu"});
+      branches.insert(branches.end(), kHLTPaths.begin(), kHLTPaths.end());
+    }
+  }
+  TreeIO::Configure(&chain, 0, chain.GetEntries(), TreeIOOptions::FromEnv(), branches);
+
+  while (reader.Next()) {
+    if (*run >= 170000) continue;
+    const ULong64_t mask = friendMask ? **storedMask : trigger->Mask();
+    for (size_t i = 0; i < mass.GetSize(); i++) {
+      if (charge[i] != 0 || !mediumId[t1muIdx[i]] || !mediumId[t2muIdx[i]]) continue;
+      const DimuonCandidate dimu{mass[i], pt[t1muIdx[i]], pt[t2muIdx[i]]};
+      // in double precision, like TTreeFormula
+      const double x = std::log10(double(dimu.mass));
+      const double w = 2. / std::log(10.) / dimu.mass;
+      for (const auto &selection : selections)
+        if (selection.pass(mask, dimu)) selection.h->Fill(x, w);
+    }
+  }
+}
+
+// Trigger groups of the selections
+inline bool NotDoubleMu(ULong64_t mask) { return !Overlaps(mask); }
+// all except displaced, trimuon, and 0 threshold triggers
+inline bool AllMuOnia(ULong64_t mask) { return (mask & kJpsiThreshold) != 0 && (mask & kAllMuOniaVeto) == 0; }
+inline bool Any(ULong64_t mask, ULong64_t paths) { return (mask & paths) != 0; }
+
+inline bool PtAbove(const DimuonCandidate &dimu, double pt) { return dimu.pt1 > pt && dimu.pt2 > pt; }
+inline bool MassIn(const DimuonCandidate &dimu, double low, double high) { return dimu.mass > low && dimu.mass < high; }
+
+// The MuOnia selections of the examples, in the order of their Draw calls
+struct MuOniaSelection {
+  const char *histogram;  // name of the histogram in Dimuon2011_eospublic.C
+  const char *title;
+  bool (*pass)(ULong64_t mask, const DimuonCandidate &dimu);
+};
+
+const std::vector<MuOniaSelection> kMuOniaSelections = {
+  // all except displaced, trimuon, and 0 threshold triggers (and events already treated from DoubleMuon)
+  {"h_dimulog4", "all MuOnia",
+   [](ULong64_t mask, const DimuonCandidate &dimu) {
+     return NotDoubleMu(mask) && AllMuOnia(mask) && dimu.mass > 2. && PtAbove(dimu, 3.);
+   }},
+  // early 2011A Quarkonium trigger only, was cut offline at m>2
+  {"h_dimulog2", "Quarkonium/Low pT dimuon only",
+   [](ULong64_t mask, const DimuonCandidate &dimu) {
+     return NotDoubleMu(mask) && Any(mask, kQuarkonium) && dimu.mass > 2. && PtAbove(dimu, 2.);
+   }},
+  // to take care of the tails, Upsilon should have cuts 7<m<14
+  {"h_dimulog6", "Quarkonium and Upsilon",
+   [](ULong64_t mask, const DimuonCandidate &dimu) {
+     return NotDoubleMu(mask) && (Any(mask, kQuarkonium) || (Any(mask, kUpsilon) && MassIn(dimu, 7., 14.))) &&
+            dimu.mass > 2. && PtAbove(dimu, 2.);
+   }},
+  // to take care of the tails, B0 should have cuts 4<m<7
+  {"h_dimulog7", "Quarkonium and B0",
+   [](ULong64_t mask, const DimuonCandidate &dimu) {
+     return NotDoubleMu(mask) && ((Any(mask, kQuarkonium) && PtAbove(dimu, 2.)) || (Any(mask, kBs) && MassIn(dimu, 4., 7.))) &&
+            dimu.mass > 2. && PtAbove(dimu, 2.);
+   }},
+  // to take care of the tails, Dimuon0 and Dimuon6p5 should have cuts 2.8<m<3.4, Dimuon10/13 should have cuts 2.5<m<4.3
+  {"h_dimulog8", "Quarkonium and Jpsi",
+   [](ULong64_t mask, const DimuonCandidate &dimu) {
+     return NotDoubleMu(mask) &&
+            ((Any(mask, kQuarkonium) && PtAbove(dimu, 3.)) || (Any(mask, kJpsi6p5) && MassIn(dimu, 2.5, 4.3)) ||
+             (Any(mask, kJpsi) && MassIn(dimu, 2.8, 3.4))) &&
+            dimu.mass > 2. && PtAbove(dimu, 1.5);
+   }},
+  // to take care of the tails, the psiprime triggers should have cuts 3.4<m<4.3
+  {"h_dimulog12", "Quarkonium and Jpsi/psiprime",
+   [](ULong64_t mask, const DimuonCandidate &dimu) {
+     return NotDoubleMu(mask) &&
+            ((Any(mask, kQuarkonium) && PtAbove(dimu, 3.)) || (Any(mask, kJpsi6p5) && MassIn(dimu, 2.5, 4.3)) ||
+             (Any(mask, kJpsi) && MassIn(dimu, 2.8, 3.4)) || (Any(mask, kPsiPrime) && MassIn(dimu, 3.4, 4.3))) &&
+            dimu.mass > 2. && PtAbove(dimu, 1.5);
+   }},
+};
+
+// Fill the histograms of kMuOniaSelections, given in the same order, in one
+// pass over the MuOnia chain
+inline void FillMuOnia(TChain &chain, const std::vector<TH1D *> &histograms)
+{
+  if (histograms.size() != kMuOniaSelections.size())
+    throw std::invalid_argument("FillMuOnia: " + std::to_string(kMuOniaSelections.size()) + " histograms expected");
+  std::vector<LogMassSelection> selections;
+  for (size_t i = 0; i < histograms.size(); i++) selections.push_back({histograms[i], kMuOniaSelections[i].pass});
+  FillLogMass(chain, selections);
+}
+
+} // namespace DimuonLogMass2011
+
+#endif
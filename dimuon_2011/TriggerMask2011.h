@@ -0,0 +1,284 @@
+// Packed trigger bits for the 2011 DoubleMu and MuOnia NanoAODRun1 samples.
+//
+// All HLT booleans (and the few trigger threshold flags) used by the 2011
+// dimuon examples are packed into one ULong64_t column, HLT_mask, with one
+// bit per path. A trigger requirement of a selection then becomes a single
+// AND against one of the constexpr masks below, instead of a chain of
+// boolean column reads that is compiled from a string for every selection.
+//
+// The column is either defined at read time on an RDataFrame,
+//   auto df_mask = TriggerMask2011::Define(df);
+// or written once into a derived file with makeTriggerMask2011.C, which can
+// be used as a friend tree ("HLTmask") of the original sample. The derived
+// file also stores the name, UUID and number of entries of the file it was
+// made from, and AttachMask only adds it as a friend of that same file:
+//   bool useMask = TriggerMask2011::AttachMask(*chain, "Run2011A_MuOnia_HLTmask.root");
+// Compiled TTreeReader loops compute the same mask with TriggerMask2011::Reader.
+
+#ifndef NANOAODRUN1_TRIGGERMASK2011_H
+#define NANOAODRUN1_TRIGGERMASK2011_H
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ROOT/RDataFrame.hxx"
+#include "TChain.h"
+#include "TError.h"
+#include "TFile.h"
+#include "TLeaf.h"
+#include "TNamed.h"
+#include "TParameter.h"
+#include "TSystem.h"
+#include "TTree.h"
+#include "TTreeReader.h"
+#include "TTreeReaderValue.h"
+
+namespace TriggerMask2011 {
+
+// Bit numbers. The HLT paths come first, in the order of kHLTPaths.
+enum Bit : unsigned int {
+  kDoubleMu3_Quarkonium,
+  kDoubleMu4_LowMass_Displaced, kDoubleMu4p5_LowMass_Displaced, kDoubleMu5_LowMass_Displaced,
+  kDimuon6p5_LowMass_Displaced, kDimuon7_LowMass_Displaced,
+  kDoubleMu4_Jpsi_Displaced, kDoubleMu5_Jpsi_Displaced, kDimuon6p5_Jpsi_Displaced, kDimuon7_Jpsi_Displaced,
+  kMu5_L2Mu2,
+  kDimuon0_Upsilon, kDimuon0_Barrel_Upsilon, kDoubleMu3_Upsilon, kDimuon5_Upsilon_Barrel, kDimuon7_Upsilon_Barrel,
+  kDimuon6_Bs, kDimuon4_Bs_Barrel, kDoubleMu4_Dimuon6_Bs, kDoubleMu4_Dimuon4_Bs_Barrel, kDoubleMu3_Bs, kDoubleMu2_Bs,
+  kDimuon6p5_Jpsi, kDimuon6p5_Barrel_Jpsi,
+  kDimuon0_Jpsi, kDimuon13_Jpsi_Barrel, kDimuon10_Jpsi_Barrel,
+  kDimuon11_PsiPrime, kDimuon9_PsiPrime, kDimuon7_PsiPrime,
+  kNHLTPaths,
+  // flags derived from the trigger threshold and sample overlap columns
+  kJpsiThresh = kNHLTPaths,  // Trig_JpsiThresh != 0
+  kDoubleMuThresh12,         // Trig_DoubleMuThresh > 12
+  kAlsoOnDoubleMu,           // Alsoon_DoubleMu
+  kNBits
+};
+static_assert(kNBits <= 64, "the trigger bits have to fit into a ULong64_t");
+
+// HLT branches, in bit order
+const std::vector<std::string> kHLTPaths = {
+  "HLT_DoubleMu3_Quarkonium",
+  "HLT_DoubleMu4_LowMass_Displaced", "HLT_DoubleMu4p5_LowMass_Displaced", "HLT_DoubleMu5_LowMass_Displaced",
+  "HLT_Dimuon6p5_LowMass_Displaced", "HLT_Dimuon7_LowMass_Displaced",
+  "HLT_DoubleMu4_Jpsi_Displaced", "HLT_DoubleMu5_Jpsi_Displaced", "HLT_Dimuon6p5_Jpsi_Displaced",
+  "HLT_Dimuon7_Jpsi_Displaced",
+  "HLT_Mu5_L2Mu2",
+  "HLT_Dimuon0_Upsilon", "HLT_Dimuon0_Barrel_Upsilon", "HLT_DoubleMu3_Upsilon", "HLT_Dimuon5_Upsilon_Barrel",
+  "HLT_Dimuon7_Upsilon_Barrel",
+  "HLT_Dimuon6_Bs", "HLT_Dimuon4_Bs_Barrel", "HLT_DoubleMu4_Dimuon6_Bs", "HLT_DoubleMu4_Dimuon4_Bs_Barrel",
+  "HLT_DoubleMu3_Bs", "HLT_DoubleMu2_Bs",
+  "HLT_Dimuon6p5_Jpsi", "HLT_Dimuon6p5_Barrel_Jpsi",
+  "HLT_Dimuon0_Jpsi", "HLT_Dimuon13_Jpsi_Barrel", "HLT_Dimuon10_Jpsi_Barrel",
+  "HLT_Dimuon11_PsiPrime", "HLT_Dimuon9_PsiPrime", "HLT_Dimuon7_PsiPrime"};
+
+constexpr ULong64_t Mask(unsigned int bit) { return 1ULL << bit; }
+
+// Trigger groups used by the selections ("any of")
+constexpr ULong64_t kQuarkonium = Mask(kDoubleMu3_Quarkonium);
+constexpr ULong64_t kLowMassDisplacedUsed = Mask(kDimuon7_LowMass_Displaced) | Mask(kDimuon6p5_LowMass_Displaced);
+constexpr ULong64_t kLowMassDisplaced = kLowMassDisplacedUsed | Mask(kDoubleMu4_LowMass_Displaced) |
+                                        Mask(kDoubleMu4p5_LowMass_Displaced) | Mask(kDoubleMu5_LowMass_Displaced);
+constexpr ULong64_t kJpsiDisplaced = Mask(kDoubleMu4_Jpsi_Displaced) | Mask(kDoubleMu5_Jpsi_Displaced) |
+                                     Mask(kDimuon6p5_Jpsi_Displaced) | Mask(kDimuon7_Jpsi_Displaced);
+constexpr ULong64_t kUpsilon = Mask(kDimuon0_Upsilon) | Mask(kDimuon0_Barrel_Upsilon) | Mask(kDoubleMu3_Upsilon) |
+                               Mask(kDimuon5_Upsilon_Barrel) | Mask(kDimuon7_Upsilon_Barrel);
+constexpr ULong64_t kBs = Mask(kDimuon6_Bs) | Mask(kDimuon4_Bs_Barrel) | Mask(kDoubleMu4_Dimuon6_Bs) |
+                          Mask(kDoubleMu4_Dimuon4_Bs_Barrel) | Mask(kDoubleMu3_Bs) | Mask(kDoubleMu2_Bs);
+constexpr ULong64_t kJpsi6p5 = Mask(kDimuon6p5_Jpsi) | Mask(kDimuon6p5_Barrel_Jpsi);
+constexpr ULong64_t kJpsi = Mask(kDimuon0_Jpsi) | Mask(kDimuon13_Jpsi_Barrel) | Mask(kDimuon10_Jpsi_Barrel);
+constexpr ULong64_t kPsiPrime = Mask(kDimuon11_PsiPrime) | Mask(kDimuon9_PsiPrime) | Mask(kDimuon7_PsiPrime);
+
+// Displaced, trimuon and 0 threshold triggers vetoed by the "all MuOnia" selection
+constexpr ULong64_t kAllMuOniaVeto = kLowMassDisplaced | kJpsiDisplaced | Mask(kMu5_L2Mu2);
+
+// Threshold flags ("all of")
+constexpr ULong64_t kJpsiThreshold = Mask(kJpsiThresh);
+constexpr ULong64_t kDoubleMuThreshold = Mask(kDoubleMuThresh12);
+// events of the MuOnia sample already used from the DoubleMu sample
+constexpr ULong64_t kDoubleMuOverlap = Mask(kAlsoOnDoubleMu) | Mask(kDoubleMuThresh12);
+
+inline bool Overlaps(ULong64_t mask) { return (mask & kDoubleMuOverlap) == kDoubleMuOverlap; }
+
+namespace Detail {
+
+template <std::size_t> using Fired = bool;
+
+// Callable packing N HLT booleans into bits 0 to N-1
+template <std::size_t... I>
+auto MakePacker(std::index_sequence<I...>) {
+  return [](Fired<I>... fired) { return ((ULong64_t(fired) << I) | ... | 0ULL); };
+}
+
+// Define a boolean column from a numeric column of any type, e.g. Int_t or Float_t
+template <typename Predicate>
+ROOT::RDF::RNode DefineFlag(ROOT::RDF::RNode node, const std::string &name, const std::string &column, Predicate pass) {
+  const std::string type = node.GetColumnType(column);
+  if (type == "Int_t" || type == "int") return node.Define(name, [pass](Int_t v) { return pass(v); }, {column});
+  if (type == "UInt_t" || type == "unsigned int") return node.Define(name, [pass](UInt_t v) { return pass(v); }, {column});
+  if (type == "Short_t" || type == "short") return node.Define(name, [pass](Short_t v) { return pass(v); }, {column});
+  if (type == "UShort_t") return node.Define(name, [pass](UShort_t v) { return pass(v); }, {column});
+  if (type == "Char_t") return node.Define(name, [pass](Char_t v) { return pass(v); }, {column});
+  if (type == "UChar_t") return node.Define(name, [pass](UChar_t v) { return pass(v); }, {column});
+  if (type == "Bool_t" || type == "bool") return node.Define(name, [pass](bool v) { return pass(v); }, {column});
+  if (type == "Float_t" || type == "float") return node.Define(name, [pass](Float_t v) { return pass(v); }, {column});
+  if (type == "Double_t" || type == "double") return node.Define(name, [pass](Double_t v) { return pass(v); }, {column});
+  throw std::runtime_error("TriggerMask2011: unsupported type " + type + " of column " + column);
+}
+
+// Reader of a numeric branch of any type, converted to double
+template <typename T>
+std::function<double()> MakeReader(TTreeReader &reader, const std::string &branch) {
+  auto value = std::make_shared<TTreeReaderValue<T>>(reader, branch.c_str());
+  return [value] { return double(**value); };
+}
+
+inline std::function<double()> ReadNumber(TTreeReader &reader, TTree &tree, const std::string &branch) {
+  TLeaf *leaf = tree.GetLeaf(branch.c_str());
+  if (!leaf) throw std::runtime_error("TriggerMask2011: no branch " + branch);
+  const std::string type = leaf->GetTypeName();
+  if (type == "Int_t") return MakeReader<Int_t>(reader, branch);
+  if (type == "UInt_t") return MakeReader<UInt_t>(reader, branch);
+  if (type == "Short_t") return MakeReader<Short_t>(reader, branch);
+  if (type == "UShort_t") return MakeReader<UShort_t>(reader, branch);
+  if (type == "Char_t") return MakeReader<Char_t>(reader, branch);
+  if (type == "UChar_t") return MakeReader<UChar_t>(reader, branch);
+  if (type == "Bool_t") return MakeReader<Bool_t>(reader, branch);
+  if (type == "Float_t") return MakeReader<Float_t>(reader, branch);
+  if (type == "Double_t") return MakeReader<Double_t>(reader, branch);
+  throw std::runtime_error("TriggerMask2011: unsupported type " + type + " of branch " + branch);
+}
+
+} // namespace Detail
+
+// The mask of the current entry of a TTreeReader loop, with the same bits as
+// the HLT_mask column of Define:
+//   TTreeReader reader(chain);
+//   TriggerMask2011::Reader trigger(reader, *chain);
+//   while (reader.Next()) { ULong64_t mask = trigger.Mask(); ... }
+class Reader {
+public:
+  Reader(TTreeReader &reader, TTree &tree, bool withHLTPaths = true)
+    : fThresh12(Detail::ReadNumber(reader, tree, "Trig_DoubleMuThresh")) {
+    if (!withHLTPaths) return;
+    fJpsi = Detail::ReadNumber(reader, tree, "Trig_JpsiThresh");
+    fAlsoOn = Detail::ReadNumber(reader, tree, "Alsoon_DoubleMu");
+    for (const auto &path : kHLTPaths) fHLT.push_back(std::make_unique<TTreeReaderValue<Bool_t>>(reader, path.c_str()));
+  }
+
+  ULong64_t Mask() const {
+    ULong64_t mask = 0;
+    for (size_t i = 0; i < fHLT.size(); i++) mask |= ULong64_t(**fHLT[i]) << i;
+    if (fJpsi && fJpsi() != 0) mask |= TriggerMask2011::Mask(kJpsiThresh);
+    if (fThresh12() > 12) mask |= TriggerMask2011::Mask(kDoubleMuThresh12);
+    if (fAlsoOn && fAlsoOn() != 0) mask |= TriggerMask2011::Mask(kAlsoOnDoubleMu);
+    return mask;
+  }
+
+private:
+  std::function<double()> fThresh12, fJpsi, fAlsoOn;
+  std::vector<std::unique_ptr<TTreeReaderValue<Bool_t>>> fHLT;
+};
+
+// Define the column with the packed trigger bits. Without HLT paths (e.g. for
+// the DoubleMu sample) only the threshold and overlap flags are filled.
+inline ROOT::RDF::RNode Define(ROOT::RDF::RNode node, const std::string &column = "HLT_mask", bool withHLTPaths = true) {
+  node = withHLTPaths ? Detail::DefineFlag(node, column + "_jpsi", "Trig_JpsiThresh", [](auto v) { return v != 0; })
+                      : node.Define(column + "_jpsi", [] { return false; });
+  node = Detail::DefineFlag(node, column + "_thresh12", "Trig_DoubleMuThresh", [](auto v) { return v > 12; });
+  node = withHLTPaths ? Detail::DefineFlag(node, column + "_alsoon", "Alsoon_DoubleMu", [](auto v) { return v != 0; })
+                      : node.Define(column + "_alsoon", [] { return false; });
+  node = withHLTPaths ? node.Define(column + "_hlt", Detail::MakePacker(std::make_index_sequence<kNHLTPaths>{}), kHLTPaths)
+                      : node.Define(column + "_hlt", [] { return ULong64_t(0); });
+  return node.Define(column,
+                     [](ULong64_t hlt, bool jpsi, bool thresh12, bool alsoon) {
+                       return hlt | (ULong64_t(jpsi) << kJpsiThresh) | (ULong64_t(thresh12) << kDoubleMuThresh12) |
+                              (ULong64_t(alsoon) << kAlsoOnDoubleMu);
+                     },
+                     {column + "_hlt", column + "_jpsi", column + "_thresh12", column + "_alsoon"});
+}
+
+// Names of the objects with the source of a mask file: the name of the input
+// file without directory (so that a local copy of an eospublic file matches),
+// its UUID and its number of entries
+constexpr const char *kSourceName = "source";
+constexpr const char *kSourceUUID = "sourceUUID";
+constexpr const char *kSourceEntries = "sourceEntries";
+
+// Store the source of the masks in maskFile, after they have been written
+// from the tree of sourceFile
+inline void WriteSource(const std::string &maskFile, const std::string &sourceFile, const std::string &tree = "Events")
+{
+  std::unique_ptr<TFile> source(TFile::Open(sourceFile.c_str()));
+  if (!source || source->IsZombie()) throw std::runtime_error("TriggerMask2011: cannot open " + sourceFile);
+  std::unique_ptr<TTree> events(source->Get<TTree>(tree.c_str()));
+  if (!events) throw std::runtime_error("TriggerMask2011: no tree " + tree + " in " + sourceFile);
+  std::unique_ptr<TFile> mask(TFile::Open(maskFile.c_str(), "UPDATE"));
+  if (!mask || mask->IsZombie()) throw std::runtime_error("TriggerMask2011: cannot update " + maskFile);
+  const TNamed name(kSourceName, gSystem->BaseName(sourceFile.c_str()));
+  const TNamed uuid(kSourceUUID, source->GetUUID().AsString());
+  const TParameter<Long64_t> entries(kSourceEntries, events->GetEntries());
+  mask->WriteTObject(&name);
+  mask->WriteTObject(&uuid);
+  mask->WriteTObject(&entries);
+}
+
+// Why the masks of the file mask were not made from the file of the chain,
+// or an empty string if they were
+inline std::string SourceMismatch(TChain &chain, TDirectory &mask)
+{
+  std::unique_ptr<TNamed> name(mask.Get<TNamed>(kSourceName)), uuid(mask.Get<TNamed>(kSourceUUID));
+  std::unique_ptr<TParameter<Long64_t>> entries(mask.Get<TParameter<Long64_t>>(kSourceEntries));
+  if (!name || !uuid || !entries) return "no source stored, written by an older makeTriggerMask2011.C";
+  if (chain.GetListOfFiles()->GetEntries() != 1) return "made from one file, the chain has several";
+  const std::string file = chain.GetListOfFiles()->At(0)->GetTitle();
+  if (name->GetTitle() != std::string(gSystem->BaseName(file.c_str())))
+    return std::string("made from ") + name->GetTitle() + ", not " + file;
+  if (entries->GetVal() != chain.GetEntries())
+    return "made from " + std::to_string(entries->GetVal()) + " entries, the chain has " +
+           std::to_string(chain.GetEntries());
+  if (chain.LoadTree(0) < 0 || !chain.GetFile()) return "cannot open " + file;
+  if (uuid->GetTitle() != std::string(chain.GetFile()->GetUUID().AsString()))
+    return "made from a different file " + std::string(name->GetTitle()) + " (UUID " + uuid->GetTitle() + ")";
+  return "";
+}
+
+// Add maskFile as friend of the chain if it exists and was made from the file
+// of the chain. Otherwise the masks have to be computed from the HLT branches;
+// a mask file of another input is reported.
+inline bool AttachMask(TChain &chain, const std::string &maskFile, const char *friendName = "HLTmask")
+{
+  if (gSystem->AccessPathName(maskFile.c_str())) return false;
+  std::unique_ptr<TFile> mask(TFile::Open(maskFile.c_str()));
+  const std::string mismatch = mask && !mask->IsZombie() ? SourceMismatch(chain, *mask) : "cannot be opened";
+  if (!mismatch.empty()) {
+    Warning("TriggerMask2011::AttachMask", "not using %s (%s), reading the HLT branches", maskFile.c_str(),
+            mismatch.c_str());
+    return false;
+  }
+  chain.AddFriend(friendName, maskFile.c_str());
+  return true;
+}
+
+// Whether the chain has a friend with the masks of its file, e.g. one added
+// with AddFriend instead of AttachMask. A friend made from another input is
+// reported and removed.
+inline bool HasMaskFriend(TChain &chain, const char *friendName = "HLTmask")
+{
+  TTree *masks = chain.GetFriend(friendName);
+  if (!masks) return false;
+  TFile *mask = masks->GetCurrentFile();
+  const std::string mismatch = mask ? SourceMismatch(chain, *mask) : "not read from a file";
+  if (mismatch.empty()) return true;
+  Warning("TriggerMask2011::HasMaskFriend", "not using friend %s (%s), reading the HLT branches", friendName,
+          mismatch.c_str());
+  chain.RemoveFriend(masks);
+  return false;
+}
+
+} // namespace TriggerMask2011
+
+#endif
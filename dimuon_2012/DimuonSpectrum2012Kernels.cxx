@@ -0,0 +1,50 @@
+#include "DimuonSpectrum2012Kernels.h"
+
+namespace DimuonSpectrum2012 {
+
+bool TwoMuons(UInt_t nMuon) {
+  return nMuon > 1;
+}
+
+bool OppositeCharge(const ROOT::RVec<int> &charge, const ROOT::RVec<float> &pt) {
+  return charge[0] != charge[1] && (pt[0] > 3 && pt[1] > 3);
+}
+
+float InvariantMass(const ROOT::RVec<float> &pt, const ROOT::RVec<float> &eta, const ROOT::RVec<float> &phi,
+                    const ROOT::RVec<float> &mass) {
+  thread_local DimuonMassKernel kernel;
+  const unsigned int first = 0, second = 1;
+  float m;
+  kernel.SetMuons(2, pt.data(), eta.data(), phi.data(), mass.data());
+  kernel.Masses(1, &first, &second, &m);
+  return m;
+}
+
+ROOT::RDF::RNode SelectTwoMuons(ROOT::RDataFrame &df) {
+  return df.Filter(TwoMuons, {"nMuon"}, "Events with at least two muons");
+}
+
+ROOT::RDF::RNode SelectOppositeCharge(ROOT::RDF::RNode df) {
+  return df.Filter(OppositeCharge, {"Muon_charge", "Muon_pt"}, "Muons with opposite charge");
+}
+
+ROOT::RDF::RNode DefineMass(ROOT::RDF::RNode df) {
+  return df.Define("Dimuon_mass", InvariantMass, {"Muon_pt", "Muon_eta", "Muon_phi", "Muon_mass"});
+}
+
+ROOT::RDF::RResultPtr<TH1D> BookMass(ROOT::RDF::RNode df, const ROOT::RDF::TH1DModel &model) {
+  return df.Histo1D<float>(model, "Dimuon_mass");
+}
+
+SkimCache MakeSkimCache() {
+  return SkimCache(
+    "nMuon >= 2", [](ROOT::RDF::RNode df) { return df.Filter(TwoMuons, {"nMuon"}, "Skim"); },
+    {"nMuon", "Muon_pt", "Muon_eta", "Muon_phi", "Muon_mass", "Muon_charge"});
+}
+
+ROOT::RDF::RResultPtr<TH1D> BookBatch(ROOT::RDF::RNode df, const ROOT::RDF::TH1DModel &model,
+                                      DimuonBatchCutFlow &cutFlow) {
+  return BookDimuonBatch(df, model, cutFlow);
+}
+
+} // namespace DimuonSpectrum2012
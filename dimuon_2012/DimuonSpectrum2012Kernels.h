@@ -0,0 +1,61 @@
+// Compiled selection and mass kernels of the 2012 dimuon spectrum, for
+// dimuonSpectrum2012_eospublic.py.
+//
+// The Python example used to declare its mass function with
+// gInterpreter.Declare and to book string filters and columns, which are
+// just-in-time compiled at every start. The functions below book the same
+// nodes with typed C++ callables instead; they are compiled once into a
+// shared library with a ROOT dictionary, either by the CMake build
+// (libDimuonSpectrum2012Kernels.so, see CMakeLists.txt) or by ACLiC on the
+// first run of the script (DimuonSpectrum2012Kernels_cxx.so, next to this
+// file, rebuilt only when the source changes), and loaded with gSystem.Load.
+// The dictionary also holds the helper classes the script uses (Throughput,
+// SkimCache and DimuonBatchCutFlow), and the skim cache gets the preselection
+// as a compiled filter, so nothing is compiled by the interpreter, neither
+// when the script starts nor when the event loops start.
+//
+// Usage (Python):
+//   ROOT.gSystem.Load("libDimuonSpectrum2012Kernels")
+//   kernels = ROOT.DimuonSpectrum2012
+//   throughput = ROOT.Throughput("dimuonSpectrum2012_py_eospublic", nThreads)
+//   files = kernels.MakeSkimCache().Files("Events", files)
+//   df_2mu = kernels.SelectTwoMuons(df)
+//   df_mass = kernels.DefineMass(kernels.SelectOppositeCharge(df_2mu))
+//   hist = kernels.BookMass(df_mass, ROOT.RDF.TH1DModel("", "", 30000, 0.25, 300.))
+
+#ifndef NANOAODRUN1_DIMUONSPECTRUM2012KERNELS_H
+#define NANOAODRUN1_DIMUONSPECTRUM2012KERNELS_H
+
+#include "ROOT/RDataFrame.hxx"
+#include "ROOT/RVec.hxx"
+#include "RtypesCore.h"
+#include "TH1D.h"
+#include "../common/DimuonBatch.h"
+#include "../common/SkimCache.h"
+#include "../common/Throughput.h"
+
+namespace DimuonSpectrum2012 {
+
+// Event selection and invariant mass of the first two muons
+bool TwoMuons(UInt_t nMuon);
+bool OppositeCharge(const ROOT::RVec<int> &charge, const ROOT::RVec<float> &pt);
+float InvariantMass(const ROOT::RVec<float> &pt, const ROOT::RVec<float> &eta, const ROOT::RVec<float> &phi,
+                    const ROOT::RVec<float> &mass);
+
+// The nodes of dimuonSpectrum2012_eospublic.py, with the same filter names
+ROOT::RDF::RNode SelectTwoMuons(ROOT::RDataFrame &df);
+ROOT::RDF::RNode SelectOppositeCharge(ROOT::RDF::RNode df);
+ROOT::RDF::RNode DefineMass(ROOT::RDF::RNode df);
+ROOT::RDF::RResultPtr<TH1D> BookMass(ROOT::RDF::RNode df, const ROOT::RDF::TH1DModel &model);
+
+// Skim cache of the columns read by the nodes above, with the preselection
+// "nMuon >= 2" as the compiled filter TwoMuons (see common/SkimCache.h)
+SkimCache MakeSkimCache();
+
+// BookDimuonBatch of common/DimuonBatch.h on the events with two muons
+ROOT::RDF::RResultPtr<TH1D> BookBatch(ROOT::RDF::RNode df, const ROOT::RDF::TH1DModel &model,
+                                      DimuonBatchCutFlow &cutFlow);
+
+} // namespace DimuonSpectrum2012
+
+#endif
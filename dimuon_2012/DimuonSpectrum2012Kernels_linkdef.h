@@ -0,0 +1,23 @@
+// Dictionary of DimuonSpectrum2012Kernels.h, used by the CMake build and by
+// ACLiC (which picks up <source>_linkdef.h)
+
+#ifdef __CLING__
+#pragma link off all globals;
+#pragma link off all classes;
+#pragma link off all functions;
+
+#pragma link C++ namespace DimuonSpectrum2012;
+#pragma link C++ function DimuonSpectrum2012::TwoMuons;
+#pragma link C++ function DimuonSpectrum2012::OppositeCharge;
+#pragma link C++ function DimuonSpectrum2012::InvariantMass;
+#pragma link C++ function DimuonSpectrum2012::SelectTwoMuons;
+#pragma link C++ function DimuonSpectrum2012::SelectOppositeCharge;
+#pragma link C++ function DimuonSpectrum2012::DefineMass;
+#pragma link C++ function DimuonSpectrum2012::BookMass;
+#pragma link C++ function DimuonSpectrum2012::MakeSkimCache;
+#pragma link C++ function DimuonSpectrum2012::BookBatch;
+#pragma link C++ class DimuonBatchCutFlow;
+#pragma link C++ class SkimCache;
+#pragma link C++ class Throughput;
+#pragma link C++ class Throughput::StageTimer;
+#endif
@@ -1,44 +1,147 @@
 # this example is a modified version of the one on 
 # http://opendata.cern.ch/record/12342
 
+import os
+import time
 import ROOT
 
 # Enable multi-threading
 # The default here is set to a single thread. You can choose the number of threads based on your system.
-ROOT.ROOT.EnableImplicitMT()
+# The environment variable NANOAODRUN1_NTHREADS sets it without editing the script.
+ROOT.ROOT.EnableImplicitMT(int(os.environ.get("NANOAODRUN1_NTHREADS") or 0))
+
+# The selection and the mass are compiled C++ functions (DimuonSpectrum2012Kernels.h)
+# in a shared library with a dictionary, which also holds the throughput and skim
+# cache classes used below, so that nothing is just-in-time compiled when the
+# script starts: the library of the CMake build (see CMakeLists.txt) if there is
+# one, or else compiled by ACLiC on the first run and reused by later runs.
+# NANOAODRUN1_KERNELS sets the path of the library, "aclic" always uses ACLiC, and
+# with "jit" the helper classes are declared to the interpreter and the filters
+# and columns are JIT-compiled strings as before. The library is loaded first, as
+# it provides the classes; tools/startupTime.sh compares the start-up time of these.
+load_start = time.perf_counter()
+kernels_library = os.environ.get("NANOAODRUN1_KERNELS") or "../build/lib/libDimuonSpectrum2012Kernels.so"
+jit = kernels_library == "jit"
+kernels = None
+if jit:
+    ROOT.gInterpreter.Declare('#include "../common/Throughput.h"')
+    ROOT.gInterpreter.Declare('#include "../common/SkimCache.h"')
+elif kernels_library == "aclic" or ("NANOAODRUN1_KERNELS" not in os.environ and not os.path.exists(kernels_library)):
+    if not ROOT.gSystem.CompileMacro("DimuonSpectrum2012Kernels.cxx", "kO"):
+        raise RuntimeError("cannot compile DimuonSpectrum2012Kernels.cxx")
+    kernels = ROOT.DimuonSpectrum2012
+else:
+    if ROOT.gSystem.Load(kernels_library) < 0:
+        raise RuntimeError("cannot load " + kernels_library)
+    kernels = ROOT.DimuonSpectrum2012
+load_seconds = time.perf_counter() - load_start
+
+# Event rate, bytes read and stage times, written to dimuonSpectrum2012_py_eospublic_throughput.json
+# (see common/Throughput.h), from here on; the loading above is added as the
+# stage "load kernels". The filters are not timed.
+throughput = ROOT.Throughput("dimuonSpectrum2012_py_eospublic", ROOT.ROOT.GetThreadPoolSize())
+throughput.AddStage("load kernels", load_seconds)
 
 # Create dataframe from NanoAODRun1 files  
-df = ROOT.RDataFrame("Events", {"root://eospublic.cern.ch//eos/opendata/cms/derived-data/NanoAODRun1/01-Jul-22/Run2012B_DoubleMuParked_merged.root", "root://eospublic.cern.ch//eos/opendata/cms/derived-data/NanoAODRun1/01-Jul-22/Run2012C_DoubleMuParked_merged.root"})
+# (from eospublic, or from the directory NANOAODRUN1_INDIR if set)
+# The columns used below of the events with at least two muons are read from a
+# local skim cache (see common/SkimCache.h), which is written on the first run,
+# with the preselection compiled in the kernel library (or JIT-compiled with "jit").
+# Set use_skim_cache to False to always read the original files.
+use_skim_cache = True
+files = ROOT.std.vector("std::string")()
+in_dir = os.environ.get("NANOAODRUN1_INDIR") or "root://eospublic.cern.ch//eos/opendata/cms/derived-data/NanoAODRun1/01-Jul-22"
+for f in ["Run2012B_DoubleMuParked_merged.root", "Run2012C_DoubleMuParked_merged.root"]:
+    files.push_back(in_dir.rstrip("/") + "/" + f)
+if jit:
+    cache = ROOT.SkimCache("nMuon >= 2", ["nMuon", "Muon_pt", "Muon_eta", "Muon_phi", "Muon_mass", "Muon_charge"])
+else:
+    cache = kernels.MakeSkimCache()
+stage_input = throughput.Stage("skim cache")
+if use_skim_cache:
+    files = cache.Files("Events", files)
+stage_input.Stop()
+df = ROOT.RDataFrame("Events", files)
 
 # Select events with at least two muons
-df_2mu = df.Filter("nMuon > 1", "Events with at least two muons")
-
-# Select events with two muons of opposite charge and pT> 3 GeV 
-df_os = df_2mu.Filter("(Muon_charge[0] != Muon_charge[1]) && (Muon_pt[0] > 3 && Muon_pt[1] > 3)", "Muons with opposite charge")
-
-# Compute invariant mass of the dimuon system
-# The following code just-in-time compiles the C++ function to compute
-# the invariant mass, so that the function can be called in the Define node of
-# the ROOT dataframe.
-ROOT.gInterpreter.Declare(
-"""
-using namespace ROOT::VecOps;
-float computeInvariantMass(RVec<float>& pt, RVec<float>& eta, RVec<float>& phi, RVec<float>& mass) {
-    ROOT::Math::PtEtaPhiMVector m1(pt[0], eta[0], phi[0], mass[0]);
-    ROOT::Math::PtEtaPhiMVector m2(pt[1], eta[1], phi[1], mass[1]);
-    return (m1 + m2).mass();
-}
-""")
-df_mass = df_os.Define("Dimuon_mass", "computeInvariantMass(Muon_pt, Muon_eta, Muon_phi, Muon_mass)")
+if jit:
+    df_2mu = df.Filter("nMuon > 1", "Events with at least two muons")
+else:
+    df_2mu = kernels.SelectTwoMuons(df)
 
 # Book histogram of dimuon mass spectrum
 bins = 30000 # Number of bins in the histogram
 low = 0.25 # Lower edge of the histogram
 up = 300.0 # Upper edge of the histogram
-hist = df_mass.Histo1D(ROOT.RDF.TH1DModel("", "", bins, low, up), "Dimuon_mass")
 
-# Request cut-flow report
-report = df_mass.Report()
+# Optionally write the mass of every dimuon to a candidate file (see
+# common/MassCandidateStore.h), from which tools/refillMassHistogram.C can
+# fill any other binning without running the event loop again
+write_mass_candidates = False
+
+# With NANOAODRUN1_BATCH=1, the opposite charge and pt cuts, the masses and the
+# histogram are computed by one compiled action for batches of events (see
+# common/DimuonBatch.h), with the same entries
+batch = int(os.environ.get("NANOAODRUN1_BATCH") or 0) != 0 and not write_mass_candidates
+if batch and jit:
+    ROOT.gInterpreter.Declare('#include "../common/DimuonBatch.h"')
+    batch_cuts = ROOT.DimuonBatchCutFlow()
+    hist = ROOT.BookDimuonBatch(ROOT.RDF.AsRNode(df_2mu), ROOT.RDF.TH1DModel("", "", bins, low, up), batch_cuts)
+    report = df_2mu.Report()
+elif batch:
+    batch_cuts = ROOT.DimuonBatchCutFlow()
+    hist = kernels.BookBatch(df_2mu, ROOT.RDF.TH1DModel("", "", bins, low, up), batch_cuts)
+    report = df_2mu.Report()
+elif not jit:
+    # Select events with two muons of opposite charge and pT> 3 GeV, and compute
+    # the invariant mass of the dimuon system with the batch kernel shared with
+    # the C++ examples (common/DimuonMass.h)
+    df_mass = kernels.DefineMass(kernels.SelectOppositeCharge(df_2mu))
+    hist = kernels.BookMass(df_mass, ROOT.RDF.TH1DModel("", "", bins, low, up))
+    if write_mass_candidates:
+        ROOT.gInterpreter.Declare('#include "../common/MassCandidateStore.h"')
+        candidates = ROOT.MassCandidateWriter("dimuonSpectrum2012_py_eospublic_masses.bin", df.GetNSlots(), ["opposite charge"])
+        n_candidates = ROOT.BookMassCandidates(df_mass, "Dimuon_mass", candidates)
+    report = df_mass.Report()
+else:
+    # Select events with two muons of opposite charge and pT> 3 GeV 
+    df_os = df_2mu.Filter("(Muon_charge[0] != Muon_charge[1]) && (Muon_pt[0] > 3 && Muon_pt[1] > 3)", "Muons with opposite charge")
+
+    # Compute invariant mass of the dimuon system
+    # The following code just-in-time compiles the C++ function to compute
+    # the invariant mass, so that the function can be called in the Define node of
+    # the ROOT dataframe.
+    # The mass itself is computed by the batch kernel shared with the C++ examples.
+    ROOT.gInterpreter.Declare(
+    """
+    #include "../common/DimuonMass.h"
+    using namespace ROOT::VecOps;
+    float computeInvariantMass(RVec<float>& pt, RVec<float>& eta, RVec<float>& phi, RVec<float>& mass) {
+        thread_local DimuonMassKernel kernel;
+        const unsigned int first = 0, second = 1;
+        float m;
+        kernel.SetMuons(2, pt.data(), eta.data(), phi.data(), mass.data());
+        kernel.Masses(1, &first, &second, &m);
+        return m;
+    }
+    """)
+    df_mass = df_os.Define("Dimuon_mass", "computeInvariantMass(Muon_pt, Muon_eta, Muon_phi, Muon_mass)")
+
+    hist = df_mass.Histo1D(ROOT.RDF.TH1DModel("", "", bins, low, up), "Dimuon_mass")
+
+    if write_mass_candidates:
+        ROOT.gInterpreter.Declare('#include "../common/MassCandidateStore.h"')
+        candidates = ROOT.MassCandidateWriter("dimuonSpectrum2012_py_eospublic_masses.bin", df.GetNSlots(), ["opposite charge"])
+        n_candidates = ROOT.BookMassCandidates(df_mass, "Dimuon_mass", candidates)
+
+    # Request cut-flow report
+    report = df_mass.Report()
+
+# The event loop runs here
+stage_loop = throughput.Stage("event loop")
+hist.GetValue()
+stage_loop.Stop()
+stage_plot = throughput.Stage("plot")
 
 # Create canvas for plotting
 ROOT.gStyle.SetOptStat(0)
@@ -75,5 +178,20 @@ label.DrawLatex(0.95, 0.92, "#sqrt{s} = 8 TeV, L_{int} = 11.6 fb^{-1}")
 # Save plot
 c.SaveAs("dimuonSpectrum2012_py_eospublic.pdf")
 
+stage_plot.Stop()
+
 # Print cut-flow report
 report.Print()
+if batch:
+    batch_cuts.Print()
+if use_skim_cache:
+    print("Read from skim cache: %d of %d events" % (cache.CachedEntries(), cache.InputEntries()))
+if write_mass_candidates:
+    print("Wrote %d dimuon masses to %s" % (n_candidates.GetValue(), candidates.GetName()))
+
+throughput.SetEvents(report.At("Events with at least two muons").GetAll())
+throughput.AddCutFlow(report.GetValue())
+if batch:
+    throughput.AddCut("Muons with opposite charge", batch_cuts.selected, batch_cuts.all)
+throughput.Print()
+throughput.Write()
@@ -0,0 +1,132 @@
+#!/bin/bash
+# Run the examples on local synthetic NanoAODRun1 files at several thread counts
+# and summarize their throughput and scaling efficiency.
+#
+# Usage (from the tools directory or anywhere in the repository):
+#   ./benchmark.sh [data directory] [thread counts]
+#   ./benchmark.sh                          # synthetic/, 1 2 4 8 and all cores
+#   ./benchmark.sh /data/synthetic "1 4 16"
+#
+# Environment:
+#   EVENTS    events per dataset if the files have to be generated (default 1000000)
+#   EXAMPLES  examples to run (default: the five scripts and
+#             Dimuon2011_RDF2_deterministic, see example() below for their
+#             names; Dimuon2011_compiled is the compiled Draw macro)
+#   RESULTS   output directory (default benchmark_<date>)
+#   BUILD     CMake build directory: run its executables instead of the macros
+#             where there is one (see CMakeLists.txt); configured with
+#             -DNANOAODRUN1_COUNT_ALLOCATIONS=ON, the summary also shows the
+#             heap allocations per event of the event loops
+#
+# The input files are written with generateNanoAODRun1.C if the data directory
+# does not contain them yet. Every run starts without skim cache, so that all
+# thread counts read the same input. The results directory contains the log
+# and the <example>_throughput.json of every run (see common/Throughput.h) and
+# summary.txt, with the event rate and the scaling efficiency
+#   efficiency(N) = time(1 thread) / (N * time(N threads))
+# of every example. The TTree::Draw examples are single threaded and run once.
+# Dimuon2011_RDF2_deterministic runs Dimuon2011_RDF2 with exact sums
+# (NANOAODRUN1_DETERMINISTIC=1, see common/ExactSum.h), so that its overhead
+# can be read off the summary; reproducibility.txt records whether its
+# histograms at every thread count are bitwise identical to those of the first
+# (compareHistograms.C).
+
+set -e
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+REPO=$(dirname "$TOOLS")
+DATA=$(realpath -m "${1:-$REPO/synthetic}")
+THREADS=${2:-"1 2 4 8 $(nproc)"}
+EVENTS=${EVENTS:-1000000}
+EXAMPLES=${EXAMPLES:-"MuHistos Dimuon2011 Dimuon2011_RDF2 Dimuon2011_RDF2_deterministic dimuonSpectrum2012_C dimuonSpectrum2012_py"}
+RESULTS=$(realpath -m "${RESULTS:-benchmark_$(date +%Y%m%d_%H%M%S)}")
+
+# unique and sorted thread counts, so that the 1 thread reference runs first
+THREADS=$(echo $THREADS | tr ' ' '\n' | sort -n -u | tr '\n' ' ')
+
+if [ ! -f "$DATA/Run2012C_DoubleMuParked_merged.root" ]; then
+  echo "generating $EVENTS events per dataset in $DATA"
+  (cd "$TOOLS" && root -l -b -q "generateNanoAODRun1.C+(\"$DATA\", $EVENTS)")
+fi
+
+mkdir -p "$RESULTS"
+export NANOAODRUN1_INDIR="$DATA"
+
+# the executable of the CMake build, or else the macro run by root
+run() {
+  if [ -n "$BUILD" ]; then echo "$(realpath "$BUILD")/bin/$1"; else echo "root -l -b -q $2"; fi
+}
+
+# directory, command, throughput file and output file to keep of an example
+example() {
+  case $1 in
+    MuHistos) echo "dimuon_2010|$(run MuHistos_eospublic MuHistos_eospublic.cxx++)|MuHistos_Mu_eospublic_throughput.json" ;;
+    Dimuon2011) echo "dimuon_2011|root -l -b -q Dimuon2011_eospublic.C|" ;;
+    Dimuon2011_compiled) echo "dimuon_2011|$(run Dimuon2011_eospublic_compiled Dimuon2011_eospublic_compiled.cxx++)|Dimuon2011_eospublic_compiled_throughput.json" ;;
+    Dimuon2011_RDF2) echo "dimuon_2011|$(run Dimuon2011_eospublic_RDF2 Dimuon2011_eospublic_RDF2.C)|Dimuon2011_eospublic_RDF2_throughput.json" ;;
+    Dimuon2011_RDF2_deterministic) echo "dimuon_2011|env NANOAODRUN1_DETERMINISTIC=1 $(run Dimuon2011_eospublic_RDF2 Dimuon2011_eospublic_RDF2.C)|Dimuon2011_eospublic_RDF2_throughput.json|Dimuon2011_eospublic_RDF2.root" ;;
+    dimuonSpectrum2012_C) echo "dimuon_2012|$(run dimuonSpectrum2012_eospublic dimuonSpectrum2012_eospublic.C)|dimuonSpectrum2012_C_eospublic_throughput.json" ;;
+    dimuonSpectrum2012_py) echo "dimuon_2012|python3 dimuonSpectrum2012_eospublic.py -b|dimuonSpectrum2012_py_eospublic_throughput.json" ;;
+    *) echo "unknown example $1" >&2; exit 1 ;;
+  esac
+}
+
+for name in $EXAMPLES; do
+  IFS='|' read -r dir command json output <<< "$(example "$name")"
+  for n in $THREADS; do
+    if [[ "$name" = Dimuon2011* ]] && [[ "$name" != Dimuon2011_RDF2* ]] && [ "$n" != "${THREADS%% *}" ]; then continue; fi
+    echo "=== $name, $n threads"
+    rm -rf "$REPO/$dir/skimcache"
+    start=$(date +%s.%N)
+    (cd "$REPO/$dir" && NANOAODRUN1_NTHREADS=$n $command) > "$RESULTS/${name}_${n}.log" 2>&1 \
+      || echo "  failed, see $RESULTS/${name}_${n}.log"
+    end=$(date +%s.%N)
+    awk "BEGIN { print $end - $start }" > "$RESULTS/${name}_${n}.seconds"
+    if [ -n "$json" ] && [ -f "$REPO/$dir/$json" ]; then mv "$REPO/$dir/$json" "$RESULTS/${name}_${n}.json"; fi
+    if [ -n "$output" ] && [ -f "$REPO/$dir/$output" ]; then mv "$REPO/$dir/$output" "$RESULTS/${name}_${n}.root"; fi
+  done
+done
+
+# outputs that have to be identical at every thread count
+for name in $EXAMPLES; do
+  reference=
+  for n in $THREADS; do
+    [ -f "$RESULTS/${name}_${n}.root" ] || continue
+    if [ -z "$reference" ]; then reference=$n; continue; fi
+    if (cd "$TOOLS" && root -l -b -q "compareHistograms.C+(\"$RESULTS/${name}_${n}.root\", \"$RESULTS/${name}_${reference}.root\")") \
+         > "$RESULTS/${name}_${n}.compare" 2>&1; then
+      echo "$name: $n threads identical to $reference threads"
+    else
+      echo "$name: $n threads DIFFER from $reference threads, see $RESULTS/${name}_${n}.compare"
+    fi
+  done
+done | tee "$RESULTS/reproducibility.txt"
+
+# summary table: wall time and event rate (from the throughput file if there
+# is one, else the time of the whole process), scaling efficiency relative
+# to the first thread count and allocations per event (if counted)
+python3 - "$RESULTS" $THREADS <<'EOF' | tee "$RESULTS/summary.txt"
+import json, os, sys
+results, threads = sys.argv[1], [int(n) for n in sys.argv[2:]]
+print("%-30s %8s %10s %14s %11s %13s" % ("example", "threads", "seconds", "events/s", "efficiency", "allocs/event"))
+names = sorted({f.rsplit("_", 1)[0] for f in os.listdir(results) if f.endswith(".seconds")})
+for name in names:
+    reference = None
+    for n in threads:
+        path = os.path.join(results, "%s_%d" % (name, n))
+        if not os.path.exists(path + ".seconds"):
+            continue
+        seconds = float(open(path + ".seconds").read())
+        rate = allocations = ""
+        if os.path.exists(path + ".json"):
+            data = json.load(open(path + ".json"))
+            seconds = data.get("wall_seconds", seconds)
+            rate = "%.0f" % data.get("events_per_second", 0)
+            if "event_loop_allocations_per_event" in data:
+                allocations = "%.4f" % data["event_loop_allocations_per_event"]
+        if reference is None:
+            reference = (n, seconds)
+        efficiency = reference[1] * reference[0] / (n * seconds) if seconds > 0 else 0
+        print("%-30s %8d %10.2f %14s %11.2f %13s" % (name, n, seconds, rate, efficiency, allocations))
+EOF
+echo "results in $RESULTS"
@@ -0,0 +1,67 @@
+#!/bin/bash
+# Run an RDataFrame example as n local processes, each over one shard of the
+# input (see common/Shard.h), and make its plots from the merged shards.
+#
+# Usage (from the tools directory or anywhere in the repository):
+#   ./runShards.sh [example] [shards]
+#   ./runShards.sh                                 # dimuonSpectrum2012_C, 4 shards
+#   ./runShards.sh Dimuon2011_RDF2 8
+#   CHECK=1 ./runShards.sh dimuonSpectrum2012_C 4  # compare with a single process run
+#
+# Examples: dimuonSpectrum2012_C, dimuonSpectrum2012_C_publicchain, Dimuon2011_RDF2
+#
+# Environment:
+#   NANOAODRUN1_INDIR     input directory, passed to the examples (see common/NanoAODRun1Input.h)
+#   NANOAODRUN1_NTHREADS  threads per process (default: cores / shards, at least 1)
+#   CHECK                 if 1, also run the example as a single shard (NANOAODRUN1_SHARD=0/1)
+#                         and compare its output with the sum of the shards (mergeShards.C)
+#
+# The shard files <prefix>_shard<i>of<n>.root, the logs and the throughput
+# files of the processes are written to the directory of the example. On
+# several machines, run the example with NANOAODRUN1_SHARD=i/n on machine i,
+# copy the shard files to one directory and run it there with
+# NANOAODRUN1_SHARD=merge/n.
+
+set -e
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+REPO=$(dirname "$TOOLS")
+EXAMPLE=${1:-dimuonSpectrum2012_C}
+SHARDS=${2:-4}
+THREADS=${NANOAODRUN1_NTHREADS:-$(( $(nproc) / SHARDS > 0 ? $(nproc) / SHARDS : 1 ))}
+
+# directory, macro and shard file prefix of an example
+case $EXAMPLE in
+  dimuonSpectrum2012_C) dir=dimuon_2012; macro=dimuonSpectrum2012_eospublic.C; prefix=dimuonSpectrum2012_C_eospublic ;;
+  dimuonSpectrum2012_C_publicchain) dir=dimuon_2012; macro=dimuonSpectrum2012_publicchain.C; prefix=dimuonSpectrum2012_C_publicchain ;;
+  Dimuon2011_RDF2) dir=dimuon_2011; macro=Dimuon2011_eospublic_RDF2.C; prefix=Dimuon2011_eospublic_RDF2 ;;
+  *) echo "unknown example $EXAMPLE" >&2; exit 1 ;;
+esac
+cd "$REPO/$dir"
+
+echo "=== $EXAMPLE: $SHARDS shards with $THREADS threads each"
+start=$(date +%s.%N)
+pids=()
+for ((i = 0; i < SHARDS; i++)); do
+  NANOAODRUN1_SHARD=$i/$SHARDS NANOAODRUN1_NTHREADS=$THREADS root -l -b -q "$macro" \
+    > "${prefix}_shard${i}of${SHARDS}.log" 2>&1 &
+  pids+=($!)
+done
+failed=0
+for ((i = 0; i < SHARDS; i++)); do
+  wait "${pids[$i]}" || { echo "shard $i failed, see $dir/${prefix}_shard${i}of${SHARDS}.log"; failed=1; }
+done
+[ $failed = 0 ] || exit 1
+end=$(date +%s.%N)
+echo "shards done in $(awk "BEGIN { print $end - $start }") s"
+
+NANOAODRUN1_SHARD=merge/$SHARDS root -l -b -q "$macro" > "${prefix}_merge${SHARDS}.log" 2>&1 \
+  || { echo "merge failed, see $dir/${prefix}_merge${SHARDS}.log"; exit 1; }
+echo "plots made from the merged shards, see $dir/${prefix}_merge${SHARDS}.log"
+
+if [ "$CHECK" = 1 ]; then
+  echo "=== $EXAMPLE: single process reference with $(nproc) threads"
+  NANOAODRUN1_SHARD=0/1 NANOAODRUN1_NTHREADS=$(nproc) root -l -b -q "$macro" > "${prefix}_shard0of1.log" 2>&1 \
+    || { echo "reference failed, see $dir/${prefix}_shard0of1.log"; exit 1; }
+  root -l -b -q "../tools/mergeShards.C+(\"$prefix\", $SHARDS, \"\", \"${prefix}_shard0of1.root\")"
+fi
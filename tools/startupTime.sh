@@ -0,0 +1,95 @@
+#!/bin/bash
+# Compare the start-up time of dimuonSpectrum2012_eospublic.py with its
+# filters and columns JIT-compiled from strings and with the compiled kernel
+# library (dimuon_2012/DimuonSpectrum2012Kernels.h).
+#
+# Usage (from the tools directory or anywhere in the repository):
+#   ./startupTime.sh [data directory] [warm runs]
+#   ./startupTime.sh                        # startup/, 5 warm runs
+#
+# Environment:
+#   EVENTS   events per dataset if the files have to be generated (default 10000),
+#            few enough that the run time is mostly start-up
+#   BUILD    CMake build directory with libDimuonSpectrum2012Kernels.so; without
+#            it the library is compiled by ACLiC
+#   RESULTS  output directory (default startup_<date>)
+#
+# Every mode runs once cold, i.e. with the ACLiC library removed first, so that
+# the one-time compilation is included, and then several times warm. Every run
+# starts without skim cache. summary.txt lists the process time and the time
+# of the "load kernels" (in jit mode the declaration of the helper classes) and
+# "event loop" stages (the JIT compilation of the string filters happens at the
+# start of the event loop) of every run, and the mean of the warm runs.
+
+set -e
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+REPO=$(dirname "$TOOLS")
+DATA=$(realpath -m "${1:-$REPO/startup}")
+WARM=${2:-5}
+EVENTS=${EVENTS:-10000}
+RESULTS=$(realpath -m "${RESULTS:-startup_$(date +%Y%m%d_%H%M%S)}")
+DIR="$REPO/dimuon_2012"
+
+if [ ! -f "$DATA/Run2012C_DoubleMuParked_merged.root" ]; then
+  echo "generating $EVENTS events per dataset in $DATA"
+  (cd "$TOOLS" && root -l -b -q "generateNanoAODRun1.C+(\"$DATA\", $EVENTS, 2., 1, 1, \"Run2012\")")
+fi
+
+if [ -n "$BUILD" ]; then
+  KERNELS=$(realpath "$BUILD")/lib/libDimuonSpectrum2012Kernels.so
+  [ -f "$KERNELS" ] || { echo "no $KERNELS, build the target DimuonSpectrum2012Kernels first" >&2; exit 1; }
+  MODES="jit library"
+else
+  MODES="jit aclic"
+fi
+
+mkdir -p "$RESULTS"
+export NANOAODRUN1_INDIR="$DATA"
+
+for mode in $MODES; do
+  for run in cold $(seq 1 "$WARM"); do
+    echo "=== $mode, run $run"
+    case $mode in
+      jit) kernels=jit ;;
+      library) kernels=$KERNELS ;;
+      aclic)
+        kernels=aclic
+        if [ "$run" = cold ]; then rm -f "$DIR"/DimuonSpectrum2012Kernels_cxx*; fi
+        ;;
+    esac
+    rm -rf "$DIR/skimcache"
+    start=$(date +%s.%N)
+    (cd "$DIR" && NANOAODRUN1_KERNELS=$kernels python3 dimuonSpectrum2012_eospublic.py -b) \
+      > "$RESULTS/${mode}_${run}.log" 2>&1 || echo "  failed, see $RESULTS/${mode}_${run}.log"
+    end=$(date +%s.%N)
+    awk "BEGIN { print $end - $start }" > "$RESULTS/${mode}_${run}.seconds"
+    if [ -f "$DIR/dimuonSpectrum2012_py_eospublic_throughput.json" ]; then
+      mv "$DIR/dimuonSpectrum2012_py_eospublic_throughput.json" "$RESULTS/${mode}_${run}.json"
+    fi
+  done
+done
+
+python3 - "$RESULTS" $MODES <<'EOF' | tee "$RESULTS/summary.txt"
+import json, os, sys
+results, modes = sys.argv[1], sys.argv[2:]
+print("%-10s %6s %10s %14s %12s" % ("mode", "run", "seconds", "load kernels", "event loop"))
+for mode in modes:
+    warm = []
+    runs = sorted((f[len(mode) + 1:-len(".seconds")] for f in os.listdir(results)
+                   if f.startswith(mode + "_") and f.endswith(".seconds")),
+                  key=lambda run: -1 if run == "cold" else int(run))
+    for run in runs:
+        path = os.path.join(results, "%s_%s" % (mode, run))
+        seconds = float(open(path + ".seconds").read())
+        stages = {}
+        if os.path.exists(path + ".json"):
+            stages = {s["name"]: s["seconds"] for s in json.load(open(path + ".json"))["stages"]}
+        print("%-10s %6s %10.2f %14.2f %12.2f" % (mode, run, seconds, stages.get("load kernels", 0),
+                                                  stages.get("event loop", 0)))
+        if run != "cold":
+            warm.append(seconds)
+    if warm:
+        print("%-10s %6s %10.2f" % (mode, "warm", sum(warm) / len(warm)))
+EOF
+echo "results in $RESULTS"
@@ -0,0 +1,68 @@
+#!/bin/bash
+# Compare the read-ahead settings of common/TreeIO.h on local and remote input:
+# every setting reads the muon branches of one synthetic file with readSpeed.C,
+# once from the local file and once through an XRootD server on localhost.
+#
+# Usage (from the tools directory or anywhere in the repository):
+#   ./testTreeIO.sh [data directory] [file]
+#   ./testTreeIO.sh                                   # synthetic/, Run2012B_DoubleMuParked_merged.root
+#   LATENCY_MS=20 ./testTreeIO.sh                     # with 20 ms extra round trip on localhost
+#
+# Environment:
+#   EVENTS      events per dataset if the files have to be generated (default 1000000)
+#   PORT        port of the local XRootD server (default 1094)
+#   LATENCY_MS  delay added to the loopback interface with tc/netem while the
+#               remote reads run, to emulate a WAN link (needs root)
+#
+# Without an xrootd executable only the local file is read. The page cache is
+# not dropped between the runs, so the local reads measure decompression and
+# deserialization rather than the disk.
+
+set -e
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+REPO=$(dirname "$TOOLS")
+DATA=$(realpath -m "${1:-$REPO/synthetic}")
+FILE=${2:-Run2012B_DoubleMuParked_merged.root}
+EVENTS=${EVENTS:-1000000}
+PORT=${PORT:-1094}
+
+if [ ! -f "$DATA/$FILE" ]; then
+  echo "generating $EVENTS events per dataset in $DATA"
+  (cd "$TOOLS" && root -l -b -q "generateNanoAODRun1.C+(\"$DATA\", $EVENTS)")
+fi
+# compile once, before the timed runs
+(cd "$TOOLS" && root -l -b -q -e '.L readSpeed.C+' > /dev/null)
+
+inputs="$DATA/$FILE"
+if command -v xrootd > /dev/null; then
+  xrootd -p "$PORT" -l "$DATA/xrootd.log" "$DATA" &
+  server=$!
+  trap 'kill $server 2> /dev/null; [ -n "$LATENCY_MS" ] && tc qdisc del dev lo root netem 2> /dev/null; true' EXIT
+  sleep 2
+  inputs="$inputs root://localhost:$PORT/$DATA/$FILE"
+else
+  echo "no xrootd executable, reading the local file only"
+fi
+
+# name and NANOAODRUN1_* settings of the compared configurations
+settings=(
+  "no cache|NANOAODRUN1_CACHE_MB=0"
+  "cache|NANOAODRUN1_PREFETCH=0 NANOAODRUN1_PARALLEL_UNZIP=0"
+  "cache 8 clusters|NANOAODRUN1_PREFETCH=0 NANOAODRUN1_PARALLEL_UNZIP=0 NANOAODRUN1_CACHE_CLUSTERS=8"
+  "cache + prefetch|NANOAODRUN1_PREFETCH=1 NANOAODRUN1_PARALLEL_UNZIP=0"
+  "cache + prefetch + unzip|NANOAODRUN1_PREFETCH=1 NANOAODRUN1_PARALLEL_UNZIP=1"
+)
+
+for input in $inputs; do
+  if [[ "$input" = root://* ]] && [ -n "$LATENCY_MS" ]; then
+    tc qdisc add dev lo root netem delay "$((LATENCY_MS / 2))ms" || echo "could not add latency (tc needs root)"
+  fi
+  echo "=== $input"
+  for setting in "${settings[@]}"; do
+    IFS='|' read -r name variables <<< "$setting"
+    result=$(cd "$TOOLS" && env $variables root -l -b -q "readSpeed.C+(\"$input\")" 2>&1 | grep '^readSpeed:' || echo "failed")
+    printf "%-26s %s\n" "$name" "${result#readSpeed: }"
+  done
+  if [[ "$input" = root://* ]] && [ -n "$LATENCY_MS" ]; then tc qdisc del dev lo root netem 2> /dev/null || true; fi
+done